@@ -11,27 +11,66 @@
 #include <Windows.h>
 #include <tchar.h>
 #include <strsafe.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <io.h>
+#include <fcntl.h>
+#include <intrin.h>
+#include <emmintrin.h>
 
 #define SOFTWARE_LIST_KEY2	"Software\\Classes\\Installer\\Products"
 #define SOFTWARE_LIST_KEY	"Software\\Microsoft\\Windows\\CurrentVersion\\Uninstall"
 
 #define MAX_KEY_LENGTH			255
 #define MAX_VALUE_LENGTH		500 * sizeof(TCHAR)
+#define MAX_VALUE_NAME_LENGTH	256
 #define INSTALL_DATE_LENGTH		50
 #define DISPLAY_NAME_LENGTH		500
 #define VERSION_LENGTH			50
 #define COMPUTER_NAME_LENGTH	50
+#define PRODUCT_CODE_LENGTH		39
+#define PACKED_GUID_LENGTH		32
+#define VERSION_COMPONENTS		4
+#define VERSION_SUFFIX_RELEASE	6
+#define VERSION_SUFFIX_OTHER	7
+#define VERSION_SUFFIX_SMALL	0x70
+
+#define FLEET_READ_SIZE		65536
+#define FLEET_TERMINATOR	0x1E
+#define JOURNAL_MAGIC			0x4A534E32
+#define JOURNAL_SORT_BY_VERSION	0x00000001
+#define JOURNAL_OLDER_THAN		0x00000002
+#define JOURNAL_MAX_OUTPUT		(64 * 1024 * 1024)
+#define WORKER_COMMAND_LENGTH	(MAX_PATH + VERSION_LENGTH + 48)
+
+#define OUTPUT_BUFFER_SIZE		65536
+#define OUTPUT_CHUNK_SIZE		64
+#define CSV_HEADER				"Computer,InstallDate,DisplayName,DisplayVersion\r\n"
+
+#define IMPORT_BUFFER_SIZE		(1024 * 1024)
+#define IMPORT_LINE_LENGTH		65536
+#define IMPORT_TIMESTAMP_LENGTH	20
+#define IMPORT_DATE_WIDTH		20
 
 #define VERSION_MAJOR	1
 #define VERSION_MINOR	3
 
 
 // Global declarations.
+typedef struct VERSION_KEY
+{
+	ULONGLONG	High;
+	ULONGLONG	Low;
+	ULONGLONG	Suffix;
+} *PVERSION_KEY;
+
 typedef struct SOFTWARE_DATA
 {
-	TCHAR	InstallDate[INSTALL_DATE_LENGTH];
-	TCHAR	DisplayName[DISPLAY_NAME_LENGTH];
-	TCHAR	DisplayVersion[VERSION_LENGTH];
+	TCHAR		InstallDate[INSTALL_DATE_LENGTH];
+	TCHAR		DisplayName[DISPLAY_NAME_LENGTH];
+	TCHAR		DisplayVersion[VERSION_LENGTH];
+	TCHAR		ProductCode[PRODUCT_CODE_LENGTH];
+	VERSION_KEY	VersionKey;
 } *PSOFTWARE_DATA;
 
 typedef struct SOFTWARE_DATA_NODE
@@ -39,14 +78,131 @@ typedef struct SOFTWARE_DATA_NODE
 	SOFTWARE_DATA_NODE*	Previous;
 	SOFTWARE_DATA		Data;
 	SOFTWARE_DATA_NODE*	Next;
+	SOFTWARE_DATA_NODE*	HashNext;
 } *PSOFTWARE_DATA_NODE;
 
+typedef enum VALUE_KIND
+{
+	VALUE_STRING,
+	VALUE_PACKED_VERSION
+} VALUE_KIND;
+
+typedef struct VALUE_SCHEMA
+{
+	const TCHAR*	ValueName;
+	VALUE_KIND		Kind;
+	SIZE_T			FieldOffset;
+	DWORD			FieldLength;
+	BOOL			Required;
+	const TCHAR*	Default;
+} *PVALUE_SCHEMA;
+
+#define SCHEMA_FIELD(field)	offsetof(SOFTWARE_DATA, field), \
+							sizeof(((PSOFTWARE_DATA)0)->field) / sizeof(TCHAR)
+
 PSOFTWARE_DATA_NODE	g_pSoftwareListHead		= NULL;
 PSOFTWARE_DATA_NODE	g_pSoftwareListTail		= NULL;
 
 PSOFTWARE_DATA_NODE	g_pSoftwareListHead2	= NULL;
 PSOFTWARE_DATA_NODE	g_pSoftwareListTail2	= NULL;
 
+typedef struct FLEET_HOST
+{
+	TCHAR	ComputerName[COMPUTER_NAME_LENGTH];
+	PBYTE	Output;
+	DWORD	OutputSize;
+	DWORD	OutputCapacity;
+	LONG	Result;
+	BOOL	Done;
+} *PFLEET_HOST;
+
+typedef struct FLEET_SHARD
+{
+	LONG	Begin;
+	LONG	End;
+} *PFLEET_SHARD;
+
+typedef struct FLEET_WORKER
+{
+	DWORD	Index;
+	HANDLE	hProcess;
+	HANDLE	hInput;
+	HANDLE	hOutput;
+} *PFLEET_WORKER;
+
+PFLEET_HOST			g_pFleetHosts	= NULL;
+DWORD				g_nFleetHosts	= 0;
+LONG*				g_pFleetPending	= NULL;
+DWORD				g_nFleetPending	= 0;
+PFLEET_SHARD		g_pFleetShards	= NULL;
+DWORD				g_nFleetWorkers	= 0;
+CRITICAL_SECTION	g_csFleet;
+
+HANDLE				g_hFleetOutput	= NULL;
+DWORD				g_nFleetWritten	= 0;
+DWORD				g_nFleetFailed	= 0;
+CRITICAL_SECTION	g_csFleetOutput;
+
+typedef struct JOURNAL_RECORD
+{
+	DWORD		Magic;
+	DWORD		Format;
+	DWORD		Options;
+	DWORD		NameSize;
+	DWORD		OutputSize;
+	DWORD		Checksum;
+	VERSION_KEY	OlderThan;
+} *PJOURNAL_RECORD;
+
+HANDLE				g_hJournal		= NULL;
+CRITICAL_SECTION	g_csJournal;
+DWORD				g_nCrcTable[256];
+
+typedef struct IMPORT_JOB
+{
+	const TCHAR*		Directory;
+	TCHAR*				NamePool;
+	DWORD*				NameOffsets;
+	DWORD				FileCount;
+	volatile LONG		NextFile;
+	volatile LONG		Imported;
+	volatile LONG		Skipped;
+	volatile LONG		Rows;
+	volatile LONG		SkippedRows;
+	HANDLE				hOutput;
+	CRITICAL_SECTION	csOutput;
+} *PIMPORT_JOB;
+
+typedef enum OUTPUT_FORMAT
+{
+	OUTPUT_TEXT,
+	OUTPUT_CSV,
+	OUTPUT_JSON
+} OUTPUT_FORMAT;
+
+typedef struct OUTPUT_BUFFER
+{
+	FILE*				hFile;
+	HANDLE				hOutput;
+	CRITICAL_SECTION*	pLock;
+	PBYTE				Data;
+	DWORD				Size;
+	DWORD				Capacity;
+} *POUTPUT_BUFFER;
+
+const TCHAR* const	g_sOutputFormats[]	= { TEXT("text"), TEXT("csv"), TEXT("json") };
+const TCHAR* const	g_sOutputExtensions[]	= { TEXT(".txt"), TEXT(".csv"), TEXT(".json") };
+
+OUTPUT_FORMAT	g_nOutputFormat	= OUTPUT_TEXT;
+BOOL			g_bSse2			= FALSE;
+
+BOOL			g_bSortByVersion	= FALSE;
+const TCHAR*	g_sOlderThan		= NULL;
+VERSION_KEY		g_tOlderThan;
+
+BOOL			g_bFakeRegistry		= FALSE;
+DWORD			g_nFakeLatency		= 0;
+
 HANDLE	g_hProcessHeap	= NULL;
 HKEY	g_hBaseKey		= HKEY_LOCAL_MACHINE;
 
@@ -222,546 +378,3037 @@ void DisplaySoftwareList( FILE* hFile )
 
 
 // ----------------------------------------------------------------------------
-//  Name: DestroySoftwareList
+//  Name: FlushOutputBuffer
 //
-//  Desc: Frees the memory used by the software list.
+//  Desc: Writes the contents of an output buffer to its file. Buffers
+//        without a stream write to a file handle shared with other
+//        threads, under its lock.
 // ----------------------------------------------------------------------------
-void DestroySoftwareLists()
+void FlushOutputBuffer( POUTPUT_BUFFER pOutput )
 {
-	PSOFTWARE_DATA_NODE pCurrent, pNext;
+	DWORD nBytes;
 
-	pCurrent = g_pSoftwareListHead;
+	if( 0 == pOutput->Size ) return;
 
-	while( pCurrent )
+	if( pOutput->hFile )
 	{
-		pNext = pCurrent->Next;
-
-		HeapFree( g_hProcessHeap, NULL, pCurrent );
-
-		pCurrent = pNext;
+		fwrite( pOutput->Data, 1, pOutput->Size, pOutput->hFile );
+	}
+	else
+	{
+		EnterCriticalSection( pOutput->pLock );
+		WriteFile( pOutput->hOutput, pOutput->Data, pOutput->Size, &nBytes, NULL );
+		LeaveCriticalSection( pOutput->pLock );
 	}
 
-	g_pSoftwareListHead = NULL;
-	g_pSoftwareListTail = NULL;
+	pOutput->Size = 0;
+}
 
-	pCurrent = g_pSoftwareListHead2;
 
-	while( pCurrent )
-	{
-		pNext = pCurrent->Next;
+// ----------------------------------------------------------------------------
+//  Name: ReserveOutputBuffer
+//
+//  Desc: Makes sure the output buffer has room for nBytes more bytes.
+// ----------------------------------------------------------------------------
+void ReserveOutputBuffer( POUTPUT_BUFFER pOutput, DWORD nBytes )
+{
+	if( pOutput->Size + nBytes > pOutput->Capacity ) FlushOutputBuffer( pOutput );
+}
 
-		HeapFree( g_hProcessHeap, NULL, pCurrent );
 
-		pCurrent = pNext;
-	}
+// ----------------------------------------------------------------------------
+//  Name: WriteOutputText
+//
+//  Desc: Appends literal ASCII text to the output buffer.
+// ----------------------------------------------------------------------------
+void WriteOutputText( POUTPUT_BUFFER pOutput, const char* sText )
+{
+	DWORD nLength = lstrlenA( sText );
 
-	g_pSoftwareListHead2 = NULL;
-	g_pSoftwareListTail2 = NULL;
+	ReserveOutputBuffer( pOutput, nLength );
+
+	CopyMemory( pOutput->Data + pOutput->Size, sText, nLength );
+	pOutput->Size += nLength;
 }
 
 
 // ----------------------------------------------------------------------------
-//  Name: MergeLists
+//  Name: EncodeUnit
 //
-//  Desc: Merges the second software list into the first for a more
-//        comprehensive list of installed software.
+//  Desc: Escapes and encodes the UTF-16 unit at *pIndex as UTF-8, taking a
+//        following low surrogate with it when the unit is a high surrogate.
+//        Unpaired surrogates become U+FFFD. Returns the number of bytes
+//        written, at most six.
 // ----------------------------------------------------------------------------
-void MergeLists()
+DWORD EncodeUnit( PBYTE pOut, const WCHAR* sValue, DWORD nLength, DWORD* pIndex, OUTPUT_FORMAT nFormat )
 {
-	PSOFTWARE_DATA_NODE pCurrent, pSecond;
-	PSOFTWARE_DATA_NODE pNew;
+	static const char sHex[] = "0123456789abcdef";
+	DWORD c = sValue[(*pIndex)++];
 
-	pCurrent = g_pSoftwareListHead2;
-	
-	while( pCurrent )
+	if( c < 0x80 )
 	{
-		pSecond = g_pSoftwareListHead;
-
-		while( pSecond )
+		if( OUTPUT_CSV == nFormat )
 		{
-			if( CompareString( LOCALE_USER_DEFAULT,
-							   NORM_IGNORECASE,
-							   pSecond->Data.DisplayName,
-							   DISPLAY_NAME_LENGTH,
-							   pCurrent->Data.DisplayName,
-							   DISPLAY_NAME_LENGTH ) == CSTR_EQUAL )
-							   break;
+			// Fields are always quoted, so only quotes need escaping.
+			if( '"' == c )
+			{
+				pOut[0] = '"';
+				pOut[1] = '"';
+				return 2;
+			}
 
-			pSecond = pSecond->Next;
+			pOut[0] = (BYTE)c;
+			return 1;
 		}
 
-		if( !pSecond )
+		switch( c )
 		{
-			// Create a new list node.
-			pNew = (PSOFTWARE_DATA_NODE)HeapAlloc( g_hProcessHeap,
-												   HEAP_ZERO_MEMORY,
-												   sizeof(SOFTWARE_DATA_NODE) );
-			if( NULL == pNew )
-			{
-				_ftprintf( stderr, TEXT("Out of memory.\n") );
-			}
-			else
-			{
-				StringCchCopy( pNew->Data.InstallDate, INSTALL_DATE_LENGTH, TEXT("N/A") );
-				StringCchCopy( pNew->Data.DisplayName, INSTALL_DATE_LENGTH, pCurrent->Data.DisplayName );
-				StringCchCopy( pNew->Data.DisplayVersion, INSTALL_DATE_LENGTH, TEXT("N/A") );
+		case '"':	pOut[0] = '\\'; pOut[1] = '"'; return 2;
+		case '\\':	pOut[0] = '\\'; pOut[1] = '\\'; return 2;
+		case '\b':	pOut[0] = '\\'; pOut[1] = 'b'; return 2;
+		case '\f':	pOut[0] = '\\'; pOut[1] = 'f'; return 2;
+		case '\n':	pOut[0] = '\\'; pOut[1] = 'n'; return 2;
+		case '\r':	pOut[0] = '\\'; pOut[1] = 'r'; return 2;
+		case '\t':	pOut[0] = '\\'; pOut[1] = 't'; return 2;
+		}
 
-				AddNodeToList( pNew );
-			}
+		if( c < 0x20 )
+		{
+			pOut[0] = '\\';
+			pOut[1] = 'u';
+			pOut[2] = '0';
+			pOut[3] = '0';
+			pOut[4] = sHex[c >> 4];
+			pOut[5] = sHex[c & 0xF];
+			return 6;
 		}
 
-		pCurrent = pCurrent->Next;
+		pOut[0] = (BYTE)c;
+		return 1;
+	}
+
+	if( c < 0x800 )
+	{
+		pOut[0] = (BYTE)(0xC0 | (c >> 6));
+		pOut[1] = (BYTE)(0x80 | (c & 0x3F));
+		return 2;
+	}
+
+	if( (c >= 0xD800) && (c <= 0xDBFF) && (*pIndex < nLength) &&
+		(sValue[*pIndex] >= 0xDC00) && (sValue[*pIndex] <= 0xDFFF) )
+	{
+		c = 0x10000 + ((c - 0xD800) << 10) + (sValue[(*pIndex)++] - 0xDC00);
+
+		pOut[0] = (BYTE)(0xF0 | (c >> 18));
+		pOut[1] = (BYTE)(0x80 | ((c >> 12) & 0x3F));
+		pOut[2] = (BYTE)(0x80 | ((c >> 6) & 0x3F));
+		pOut[3] = (BYTE)(0x80 | (c & 0x3F));
+		return 4;
 	}
+
+	if( (c >= 0xD800) && (c <= 0xDFFF) ) c = 0xFFFD;
+
+	pOut[0] = (BYTE)(0xE0 | (c >> 12));
+	pOut[1] = (BYTE)(0x80 | ((c >> 6) & 0x3F));
+	pOut[2] = (BYTE)(0x80 | (c & 0x3F));
+	return 3;
 }
 
 
 // ----------------------------------------------------------------------------
-//  Name: QuerySubkey
+//  Name: NarrowPlainUnitsSse2
 //
-//  Desc: Queries the information for a key and displays the installed
-//        software information.
+//  Desc: Copies the leading run of printable ASCII that needs no escaping,
+//        eight UTF-16 units at a time, narrowing it to bytes. Stops at the
+//        first unit that needs EncodeUnit, when fewer than eight units are
+//        left, or when fewer than eight bytes of room are left. Returns the
+//        number of units copied. Only called when g_bSse2 is set, so no SSE2
+//        instruction runs on a processor without it.
 // ----------------------------------------------------------------------------
-void QuerySubkey( TCHAR* sKey, DWORD nKeyLength )
+DWORD NarrowPlainUnitsSse2( PBYTE pOut, const WCHAR* sValue, DWORD nLength, DWORD nRoom )
 {
-	TCHAR sBaseKey[MAX_KEY_LENGTH];
-	PTCHAR sValue;
-	DWORD nValueSize = MAX_VALUE_LENGTH;
-	HKEY hSubkey = NULL;
-	HANDLE hProcessHeap = NULL;
-	LONG result = ERROR_SUCCESS;
-	PSOFTWARE_DATA_NODE pNew = NULL;
-
-	// Allocate memory for the buffer to contain the value data.
-	sValue = (PTCHAR)HeapAlloc( g_hProcessHeap,
-								HEAP_ZERO_MEMORY,
-								MAX_VALUE_LENGTH );
-	if( NULL == sValue )
+	const __m128i vLow = _mm_set1_epi16( 0x1F );
+	const __m128i vHigh = _mm_set1_epi16( 0x7F );
+	const __m128i vQuote = _mm_set1_epi16( '"' );
+	const __m128i vBackslash = _mm_set1_epi16( '\\' );
+	__m128i vUnits, vPlain;
+	DWORD nCopied = 0;
+	unsigned long nPrefix;
+	int nMask;
+
+	while( (nCopied + 8 <= nLength) && (nCopied + 8 <= nRoom) )
 	{
-		_ftprintf( stderr, TEXT("Out of memory.\n") );
-		goto done;
-	}
+		vUnits = _mm_loadu_si128( (const __m128i*)(sValue + nCopied) );
 
-	// Create a new list node.
-	pNew = (PSOFTWARE_DATA_NODE)HeapAlloc( g_hProcessHeap,
-										   HEAP_ZERO_MEMORY,
-										   sizeof(SOFTWARE_DATA_NODE) );
-	if( NULL == pNew )
-	{
-		_ftprintf( stderr, TEXT("Out of memory.\n") );
-		goto done;
-	}
+		// Signed compares also reject everything at or above 0x8000.
+		vPlain = _mm_and_si128( _mm_cmpgt_epi16( vUnits, vLow ),
+								_mm_cmplt_epi16( vUnits, vHigh ) );
+		vPlain = _mm_andnot_si128( _mm_or_si128( _mm_cmpeq_epi16( vUnits, vQuote ),
+												 _mm_cmpeq_epi16( vUnits, vBackslash ) ),
+								   vPlain );
 
-	// Set up the base key.
-	StringCchCopy( sBaseKey, MAX_KEY_LENGTH, TEXT(SOFTWARE_LIST_KEY) );
+		nMask = _mm_movemask_epi8( vPlain );
 
-	// Tack on the subkey to the base key.
-	StringCchCat( sBaseKey, MAX_KEY_LENGTH, TEXT("\\") );
-	StringCchCat( sBaseKey, MAX_KEY_LENGTH, sKey );
+		// Narrow all eight; only the plain prefix is kept.
+		_mm_storel_epi64( (__m128i*)(pOut + nCopied), _mm_packus_epi16( vUnits, vUnits ) );
 
-	// Open the specific software key.
-	result = RegOpenKeyEx( g_hBaseKey,
-						   sBaseKey,
-						   0,
-						   KEY_READ,
-						   &hSubkey );
-	if( ERROR_SUCCESS != result )
-	{
-		_ftprintf( stderr, TEXT("Unable to open the required registry key!\n") );
-		goto done;
-	}
+		if( 0xFFFF != nMask )
+		{
+			_BitScanForward( &nPrefix, ~nMask & 0xFFFF );
 
-	// Retrieve the InstallDate and DisplayName values and display them.
-	result = RegQueryValueEx( hSubkey,
-							  TEXT("InstallDate"),
-							  NULL,
-							  NULL,
-							  (LPBYTE)sValue,
-							  &nValueSize );
-	if( ERROR_SUCCESS != result )
-	{
-		// If there is no InstallDate value, we don't want to fail, instead
-		// we'll put that it's not available.
-		StringCchCopy( pNew->Data.InstallDate, INSTALL_DATE_LENGTH, TEXT("N/A") );
-		result = ERROR_SUCCESS;
-	}
-	else
-	{
-		StringCchCopy( pNew->Data.InstallDate, INSTALL_DATE_LENGTH, sValue );
-	}
+			return nCopied + nPrefix / 2;
+		}
 
-	nValueSize = MAX_VALUE_LENGTH;
+		nCopied += 8;
+	}
 
-	result = RegQueryValueEx( hSubkey,
-							  TEXT("DisplayName"),
-							  NULL,
-							  NULL,
-							  (LPBYTE)sValue,
-							  &nValueSize );
-	if( ERROR_SUCCESS != result ) goto done;
+	return nCopied;
+}
 
-	StringCchCopy( pNew->Data.DisplayName, DISPLAY_NAME_LENGTH, sValue );
 
-	nValueSize = MAX_VALUE_LENGTH;
+// ----------------------------------------------------------------------------
+//  Name: WriteOutputStringN
+//
+//  Desc: Transcodes nLength UTF-16 units to UTF-8 and escapes them for the
+//        output format in a single pass. With SSE2, runs of printable ASCII
+//        go through NarrowPlainUnitsSse2; anything else drops to EncodeUnit
+//        one unit at a time.
+// ----------------------------------------------------------------------------
+void WriteOutputStringN( POUTPUT_BUFFER pOutput, const WCHAR* sValue, DWORD nLength, OUTPUT_FORMAT nFormat )
+{
+	DWORD nIndex = 0;
+	DWORD nPlain;
 
-	result = RegQueryValueEx( hSubkey,
-							  TEXT("DisplayVersion"),
-							  NULL,
-							  NULL,
-							  (LPBYTE)sValue,
-							  &nValueSize );
-	if( ERROR_SUCCESS != result )
+	while( nIndex < nLength )
 	{
-		// If there is no DisplayVersion value, we don't want to fail, instead
-		// we'll put that it's not available.
-		StringCchCopy( pNew->Data.DisplayVersion, VERSION_LENGTH, TEXT("N/A") );
-		result = ERROR_SUCCESS;
-	}
-	else
-	{
-		StringCchCopy( pNew->Data.DisplayVersion, VERSION_LENGTH, sValue );
-	}
+		// Room for at least one vector store, or the worst-case escape.
+		ReserveOutputBuffer( pOutput, OUTPUT_CHUNK_SIZE );
 
-	AddNodeToList( pNew );
+		if( g_bSse2 && (nIndex + 8 <= nLength) )
+		{
+			nPlain = NarrowPlainUnitsSse2( pOutput->Data + pOutput->Size,
+										   sValue + nIndex,
+										   nLength - nIndex,
+										   pOutput->Capacity - pOutput->Size );
 
-done:
-	if( ERROR_SUCCESS != result )
-	{
-		if( pNew ) HeapFree( g_hProcessHeap, NULL, pNew );
+			pOutput->Size += nPlain;
+			nIndex += nPlain;
+
+			if( nIndex >= nLength ) break;
+
+			ReserveOutputBuffer( pOutput, OUTPUT_CHUNK_SIZE );
+		}
+
+		pOutput->Size += EncodeUnit( pOutput->Data + pOutput->Size,
+									 sValue,
+									 nLength,
+									 &nIndex,
+									 nFormat );
 	}
+}
 
-	if( hSubkey ) RegCloseKey( hSubkey );
-	if( sValue ) HeapFree( g_hProcessHeap, NULL, sValue );
+
+// ----------------------------------------------------------------------------
+//  Name: WriteOutputString
+//
+//  Desc: Transcodes and escapes a terminated UTF-16 string.
+// ----------------------------------------------------------------------------
+void WriteOutputString( POUTPUT_BUFFER pOutput, const WCHAR* sValue, OUTPUT_FORMAT nFormat )
+{
+	WriteOutputStringN( pOutput, sValue, (DWORD)lstrlenW( sValue ), nFormat );
 }
 
 
 // ----------------------------------------------------------------------------
-//  Name: QuerySubkey2
+//  Name: DisplaySoftwareListEncoded
 //
-//  Desc: Queries the information for a key and displays the installed
-//        software information.
+//  Desc: Writes the software list as UTF-8 CSV rows or JSON lines. Output is
+//        built in a large buffer and written a block at a time.
 // ----------------------------------------------------------------------------
-void QuerySubkey2( TCHAR* sKey, DWORD nKeyLength )
+void DisplaySoftwareListEncoded( FILE* hFile, const TCHAR* sComputerName )
 {
-	TCHAR sBaseKey[MAX_KEY_LENGTH];
-	PTCHAR sValue;
-	DWORD nValueSize = MAX_VALUE_LENGTH;
-	HKEY hSubkey = NULL;
-	HANDLE hProcessHeap = NULL;
-	LONG result = ERROR_SUCCESS;
-	PSOFTWARE_DATA_NODE pNew = NULL;
+	PSOFTWARE_DATA_NODE pCurrent;
+	OUTPUT_BUFFER tOutput;
 
-	// Allocate memory for the buffer to contain the value data.
-	sValue = (PTCHAR)HeapAlloc( g_hProcessHeap,
-								HEAP_ZERO_MEMORY,
-								MAX_VALUE_LENGTH );
-	if( NULL == sValue )
+	ZeroMemory( &tOutput, sizeof(tOutput) );
+	tOutput.hFile = hFile;
+	tOutput.Capacity = OUTPUT_BUFFER_SIZE;
+	tOutput.Data = (PBYTE)HeapAlloc( g_hProcessHeap, 0, OUTPUT_BUFFER_SIZE );
+	if( NULL == tOutput.Data )
 	{
 		_ftprintf( stderr, TEXT("Out of memory.\n") );
-		goto done;
+		return;
 	}
 
-	// Create a new list node.
-	pNew = (PSOFTWARE_DATA_NODE)HeapAlloc( g_hProcessHeap,
-										   HEAP_ZERO_MEMORY,
-										   sizeof(SOFTWARE_DATA_NODE) );
-	if( NULL == pNew )
+	for( pCurrent = g_pSoftwareListHead; pCurrent; pCurrent = pCurrent->Next )
 	{
-		_ftprintf( stderr, TEXT("Out of memory.\n") );
-		goto done;
+		if( OUTPUT_CSV == g_nOutputFormat )
+		{
+			WriteOutputText( &tOutput, "\"" );
+			WriteOutputString( &tOutput, sComputerName, OUTPUT_CSV );
+			WriteOutputText( &tOutput, "\",\"" );
+			WriteOutputString( &tOutput, pCurrent->Data.InstallDate, OUTPUT_CSV );
+			WriteOutputText( &tOutput, "\",\"" );
+			WriteOutputString( &tOutput, pCurrent->Data.DisplayName, OUTPUT_CSV );
+			WriteOutputText( &tOutput, "\",\"" );
+			WriteOutputString( &tOutput, pCurrent->Data.DisplayVersion, OUTPUT_CSV );
+			WriteOutputText( &tOutput, "\"\r\n" );
+		}
+		else
+		{
+			WriteOutputText( &tOutput, "{\"computer\":\"" );
+			WriteOutputString( &tOutput, sComputerName, OUTPUT_JSON );
+			WriteOutputText( &tOutput, "\",\"installDate\":\"" );
+			WriteOutputString( &tOutput, pCurrent->Data.InstallDate, OUTPUT_JSON );
+			WriteOutputText( &tOutput, "\",\"name\":\"" );
+			WriteOutputString( &tOutput, pCurrent->Data.DisplayName, OUTPUT_JSON );
+			WriteOutputText( &tOutput, "\",\"version\":\"" );
+			WriteOutputString( &tOutput, pCurrent->Data.DisplayVersion, OUTPUT_JSON );
+			WriteOutputText( &tOutput, "\"}\n" );
+		}
 	}
 
-	// Set up the base key.
-	StringCchCopy( sBaseKey, MAX_KEY_LENGTH, TEXT(SOFTWARE_LIST_KEY2) );
-
-	// Tack on the subkey to the base key.
-	StringCchCat( sBaseKey, MAX_KEY_LENGTH, TEXT("\\") );
-	StringCchCat( sBaseKey, MAX_KEY_LENGTH, sKey );
+	FlushOutputBuffer( &tOutput );
+	HeapFree( g_hProcessHeap, NULL, tOutput.Data );
+}
 
-	// Open the specific software key.
-	result = RegOpenKeyEx( g_hBaseKey,
-						   sBaseKey,
-						   0,
-						   KEY_READ,
-						   &hSubkey );
-	if( ERROR_SUCCESS != result )
-	{
-		_ftprintf( stderr, TEXT("Unable to open the required registry key!\n") );
-		goto done;
-	}
 
-	StringCchCopy( pNew->Data.InstallDate, INSTALL_DATE_LENGTH, TEXT("N/A") );
+// ----------------------------------------------------------------------------
+//  Name: DestroySoftwareList
+//
+//  Desc: Frees the memory used by the software list.
+// ----------------------------------------------------------------------------
+void DestroySoftwareLists()
+{
+	PSOFTWARE_DATA_NODE pCurrent, pNext;
 
-	nValueSize = MAX_VALUE_LENGTH;
+	pCurrent = g_pSoftwareListHead;
 
-	result = RegQueryValueEx( hSubkey,
-							  TEXT("ProductName"),
-							  NULL,
-							  NULL,
-							  (LPBYTE)sValue,
-							  &nValueSize );
-	if( ERROR_SUCCESS != result ) goto done;
+	while( pCurrent )
+	{
+		pNext = pCurrent->Next;
 
-	StringCchCopy( pNew->Data.DisplayName, DISPLAY_NAME_LENGTH, sValue );
+		HeapFree( g_hProcessHeap, NULL, pCurrent );
 
-	nValueSize = MAX_VALUE_LENGTH;
+		pCurrent = pNext;
+	}
 
-	StringCchCopy( pNew->Data.DisplayVersion, VERSION_LENGTH, TEXT("N/A") );
+	g_pSoftwareListHead = NULL;
+	g_pSoftwareListTail = NULL;
 
-	AddNodeToList2( pNew );
+	pCurrent = g_pSoftwareListHead2;
 
-done:
-	if( ERROR_SUCCESS != result )
+	while( pCurrent )
 	{
-		if( pNew ) HeapFree( g_hProcessHeap, NULL, pNew );
+		pNext = pCurrent->Next;
+
+		HeapFree( g_hProcessHeap, NULL, pCurrent );
+
+		pCurrent = pNext;
 	}
 
-	if( hSubkey ) RegCloseKey( hSubkey );
-	if( sValue ) HeapFree( g_hProcessHeap, NULL, sValue );
+	g_pSoftwareListHead2 = NULL;
+	g_pSoftwareListTail2 = NULL;
 }
 
 
 // ----------------------------------------------------------------------------
-//  Name: _tmain
+//  Name: IsHexDigit
 //
-//  Desc: Application entry point.
+//  Desc: Returns TRUE if the character is a hexadecimal digit.
 // ----------------------------------------------------------------------------
-int _tmain( int argc, TCHAR** argv )
+BOOL IsHexDigit( TCHAR c )
 {
-	TCHAR sComputerName[COMPUTER_NAME_LENGTH];
-	TCHAR* sSubkeyName = NULL;
-	TCHAR sFilename[MAX_PATH];
-	TCHAR sPath[MAX_PATH];
-	TCHAR sTime[50];
-	TCHAR sDate[50];
-	DWORD nComputerNameSize = COMPUTER_NAME_LENGTH;
-	DWORD nSubkeyNameSize;
-	DWORD nNumberOfSubkeys;
-	HKEY hSoftwareListKey = NULL;
-	LONG result = ERROR_SUCCESS;
-	BOOL bRemoteComputer = FALSE;
-	BOOL bPrintToFile = FALSE;
-	FILE* hFile = stdout;
-	SYSTEMTIME tDateTime;
+	return ((c >= TEXT('0')) && (c <= TEXT('9'))) ||
+		   ((c >= TEXT('A')) && (c <= TEXT('F'))) ||
+		   ((c >= TEXT('a')) && (c <= TEXT('f')));
+}
 
-	if( argc > 1 )
-	{
-		if( CompareString( LOCALE_USER_DEFAULT,
-						   NORM_IGNORECASE,
-						   argv[1],
-						   2,
-						   TEXT("/?"),
-						   2 ) == CSTR_EQUAL )
-		{
-			_tprintf( TEXT("instsoft version %d.%d, Copyright (c) 2011, Lucas M. Suggs\n"), VERSION_MAJOR, VERSION_MINOR );
-			_tprintf( TEXT("Usage: %s [/f path] [computername]\n"), argv[0] );
 
-			return 0;
-		}
-	}
+// ----------------------------------------------------------------------------
+//  Name: ParseProductCode
+//
+//  Desc: Copies a {GUID} style Uninstall subkey name into sProductCode in
+//        upper case. Returns FALSE if the name is not a product code.
+// ----------------------------------------------------------------------------
+BOOL ParseProductCode( const TCHAR* sKey, DWORD nKeyLength, TCHAR* sProductCode )
+{
+	sProductCode[0] = TEXT('\0');
 
-	if( argc > 1 )
+	if( (PRODUCT_CODE_LENGTH - 1) != nKeyLength ) return FALSE;
+	if( (TEXT('{') != sKey[0]) || (TEXT('}') != sKey[nKeyLength - 1]) ) return FALSE;
+
+	for( DWORD i = 1; i < nKeyLength - 1; i++ )
 	{
-		if( argc > 2 )
+		if( (9 == i) || (14 == i) || (19 == i) || (24 == i) )
 		{
-			if( CompareString( LOCALE_USER_DEFAULT,
-							   NORM_IGNORECASE,
-							   argv[1],
-							   2,
-							   TEXT("/f"),
-							   2 ) == CSTR_EQUAL)
-			{
-				bPrintToFile = TRUE;
-
-				StringCchCopy( sPath, MAX_PATH, argv[2] );
-
-				if( argc > 3 )
-				{
-					StringCchCopy( sComputerName, nComputerNameSize, argv[3] );
-					bRemoteComputer = TRUE;
-				}
-				else
-				{
-					// Get the computer name.
-					GetComputerName( sComputerName, &nComputerNameSize );
-				}
-			}
-			else
-			{
-				StringCchCopy( sComputerName, nComputerNameSize, argv[1] );
-				bRemoteComputer = TRUE;
-			}
+			if( TEXT('-') != sKey[i] ) return FALSE;
+		}
+		else if( !IsHexDigit( sKey[i] ) )
+		{
+			return FALSE;
+		}
+	}
+
+	StringCchCopy( sProductCode, PRODUCT_CODE_LENGTH, sKey );
+	CharUpperBuff( sProductCode, nKeyLength );
+
+	return TRUE;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: DecodePackedGuid
+//
+//  Desc: Converts the packed GUID used for Installer\Products subkey names
+//        back into the {GUID} form used for Uninstall subkey names. The
+//        first three groups are stored reversed and the remaining bytes
+//        have their two nibbles swapped.
+// ----------------------------------------------------------------------------
+BOOL DecodePackedGuid( const TCHAR* sKey, DWORD nKeyLength, TCHAR* sProductCode )
+{
+	static const DWORD nGroupLengths[] = { 8, 4, 4, 4, 12 };
+	DWORD nIn = 0;
+	DWORD nOut = 0;
+
+	sProductCode[0] = TEXT('\0');
+
+	if( PACKED_GUID_LENGTH != nKeyLength ) return FALSE;
+
+	for( DWORD i = 0; i < nKeyLength; i++ )
+	{
+		if( !IsHexDigit( sKey[i] ) ) return FALSE;
+	}
+
+	sProductCode[nOut++] = TEXT('{');
+
+	for( DWORD nGroup = 0; nGroup < 5; nGroup++ )
+	{
+		if( nGroup > 0 ) sProductCode[nOut++] = TEXT('-');
+
+		for( DWORD i = 0; i < nGroupLengths[nGroup]; i++ )
+		{
+			if( nGroup < 3 )
+			{
+				sProductCode[nOut++] = sKey[nIn + nGroupLengths[nGroup] - 1 - i];
+			}
+			else
+			{
+				sProductCode[nOut++] = sKey[nIn + (i ^ 1)];
+			}
+		}
+
+		nIn += nGroupLengths[nGroup];
+	}
+
+	sProductCode[nOut++] = TEXT('}');
+	sProductCode[nOut] = TEXT('\0');
+
+	CharUpperBuff( sProductCode, nOut );
+
+	return TRUE;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: HashString
+//
+//  Desc: FNV-1a hash of a string. Callers upper case keys first.
+// ----------------------------------------------------------------------------
+DWORD HashString( const TCHAR* sValue )
+{
+	DWORD nHash = 2166136261;
+
+	while( *sValue )
+	{
+		nHash ^= (DWORD)*sValue++;
+		nHash *= 16777619;
+	}
+
+	return nHash;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: IsVersionSeparator
+//
+//  Desc: Returns TRUE for the characters that may sit between a version
+//        number and its suffix, or between a pre-release tag and its number.
+// ----------------------------------------------------------------------------
+BOOL IsVersionSeparator( TCHAR c )
+{
+	return (TEXT(' ') == c) || (TEXT('-') == c) || (TEXT('_') == c) || (TEXT('.') == c);
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: ParseVersionSuffix
+//
+//  Desc: Packs the text after the version number into a ULONGLONG whose top
+//        byte is the suffix class. The pre-release tags dev, alpha, beta,
+//        pre or preview and rc take classes 1 to 5 and carry the number that
+//        follows them, so "rc2" sorts before "rc10" and both sort before the
+//        bare version (class 6). Any other suffix, such as "SP1", "a" or
+//        "(x64)", takes class 7 and so sorts after the bare version. Up to
+//        seven bytes of lower-cased letters and numbers follow. A number
+//        below 0x70 is one byte, 0x80 + value; a larger one is a byte
+//        0xF0 + length followed by its value big-endian, so numbers compare
+//        by value and sort after letters.
+// ----------------------------------------------------------------------------
+ULONGLONG ParseVersionSuffix( const TCHAR* p )
+{
+	static const struct
+	{
+		const TCHAR*	Tag;
+		BYTE			Class;
+	} tTags[] =
+	{
+		// "preview" is tried before "pre".
+		{ TEXT("dev"),		1 },
+		{ TEXT("alpha"),	2 },
+		{ TEXT("beta"),		3 },
+		{ TEXT("preview"),	4 },
+		{ TEXT("pre"),		4 },
+		{ TEXT("rc"),		5 },
+	};
+	BYTE pPacked[sizeof(ULONGLONG) - 1];
+	ULONGLONG nSuffix;
+	ULONGLONG nValue;
+	DWORD nPacked = 0;
+	DWORD nBytes, i, j;
+	TCHAR c;
+
+	if( 0 == *p ) return (ULONGLONG)VERSION_SUFFIX_RELEASE << 56;
+
+	for( i = 0; i < sizeof(tTags) / sizeof(tTags[0]); i++ )
+	{
+		for( j = 0; tTags[i].Tag[j]; j++ )
+		{
+			c = p[j];
+			if( (c >= TEXT('A')) && (c <= TEXT('Z')) ) c += TEXT('a') - TEXT('A');
+			if( c != tTags[i].Tag[j] ) break;
+		}
+
+		if( tTags[i].Tag[j] ) continue;
+
+		// "devices" or "prerelease-notes" are not tags.
+		c = p[j];
+		if( c && !IsVersionSeparator( c ) && ((c < TEXT('0')) || (c > TEXT('9'))) ) continue;
+
+		for( p += j; IsVersionSeparator( *p ); p++ );
+
+		nValue = 0;
+
+		while( (*p >= TEXT('0')) && (*p <= TEXT('9')) )
+		{
+			nValue = nValue * 10 + (*p++ - TEXT('0'));
+			if( nValue > 0xFFFFFFFF ) nValue = 0xFFFFFFFF;
+		}
+
+		return ((ULONGLONG)tTags[i].Class << 56) | (nValue << 24);
+	}
+
+	while( *p && (nPacked < sizeof(pPacked)) )
+	{
+		c = *p;
+
+		if( (c >= TEXT('0')) && (c <= TEXT('9')) )
+		{
+			nValue = 0;
+
+			while( (*p >= TEXT('0')) && (*p <= TEXT('9')) )
+			{
+				nValue = nValue * 10 + (*p++ - TEXT('0'));
+				if( nValue > 0xFFFFFFFF ) nValue = 0xFFFFFFFF;
+			}
+
+			if( nValue < VERSION_SUFFIX_SMALL )
+			{
+				pPacked[nPacked++] = (BYTE)(0x80 + nValue);
+				continue;
+			}
+
+			for( nBytes = 1; (nBytes < sizeof(DWORD)) && (nValue >> (8 * nBytes)); nBytes++ );
+
+			pPacked[nPacked++] = (BYTE)(0x80 + VERSION_SUFFIX_SMALL + nBytes);
+
+			while( nBytes-- && (nPacked < sizeof(pPacked)) ) pPacked[nPacked++] = (BYTE)(nValue >> (8 * nBytes));
+
+			continue;
+		}
+
+		if( (c >= TEXT('A')) && (c <= TEXT('Z')) ) c += TEXT('a') - TEXT('A');
+
+		// Punctuation is dropped; other characters share one value.
+		if( c > 0x7F ) pPacked[nPacked++] = 0x7F;
+		else if( (c >= TEXT('a')) && (c <= TEXT('z')) ) pPacked[nPacked++] = (BYTE)c;
+
+		p++;
+	}
+
+	nSuffix = VERSION_SUFFIX_OTHER;
+
+	for( j = 0; j < sizeof(pPacked); j++ ) nSuffix = (nSuffix << 8) | ((j < nPacked) ? pPacked[j] : 0);
+
+	return nSuffix;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: ParseVersionKey
+//
+//  Desc: Parses a DisplayVersion string once into a key that compares in
+//        constant time. Up to four dot separated numbers are packed two to
+//        a ULONGLONG, and whatever text follows is packed by
+//        ParseVersionSuffix. Versions that do not start with a number,
+//        such as "N/A" or "latest", get an all-zero key.
+// ----------------------------------------------------------------------------
+void ParseVersionKey( const TCHAR* sVersion, PVERSION_KEY pKey )
+{
+	DWORD nComponents[VERSION_COMPONENTS] = { 0 };
+	DWORD nCount = 0;
+	ULONGLONG nValue;
+	const TCHAR* p = sVersion;
+
+	pKey->High = 0;
+	pKey->Low = 0;
+	pKey->Suffix = 0;
+
+	if( _tcscmp( sVersion, TEXT("N/A") ) == 0 ) return;
+
+	while( TEXT(' ') == *p ) p++;
+
+	// Allow a leading "v" as in "v2.1".
+	if( ((TEXT('v') == *p) || (TEXT('V') == *p)) && (p[1] >= TEXT('0')) && (p[1] <= TEXT('9')) ) p++;
+
+	while( (*p >= TEXT('0')) && (*p <= TEXT('9')) )
+	{
+		nValue = 0;
+
+		while( (*p >= TEXT('0')) && (*p <= TEXT('9')) )
+		{
+			nValue = nValue * 10 + (*p++ - TEXT('0'));
+			if( nValue > 0xFFFFFFFF ) nValue = 0xFFFFFFFF;
+		}
+
+		// Components past the fourth are ignored.
+		if( nCount < VERSION_COMPONENTS ) nComponents[nCount] = (DWORD)nValue;
+		nCount++;
+
+		if( (TEXT('.') != p[0]) || (p[1] < TEXT('0')) || (p[1] > TEXT('9')) ) break;
+
+		p++;
+	}
+
+	// Separators between the number and the suffix are not part of it.
+	while( IsVersionSeparator( *p ) ) p++;
+
+	// Without a number there is nothing to order by ("Unknown", "beta").
+	if( 0 == nCount ) return;
+
+	pKey->High = ((ULONGLONG)nComponents[0] << 32) | nComponents[1];
+	pKey->Low = ((ULONGLONG)nComponents[2] << 32) | nComponents[3];
+	pKey->Suffix = ParseVersionSuffix( p );
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: IsVersionKnown
+//
+//  Desc: Returns FALSE for the key of a missing or unparsable version.
+// ----------------------------------------------------------------------------
+BOOL IsVersionKnown( const VERSION_KEY* pKey )
+{
+	return (0 != pKey->High) || (0 != pKey->Low) || (0 != pKey->Suffix);
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: CompareVersionKeys
+//
+//  Desc: Returns a negative, zero or positive value as the first version is
+//        older than, the same as or newer than the second.
+// ----------------------------------------------------------------------------
+int CompareVersionKeys( const VERSION_KEY* pFirst, const VERSION_KEY* pSecond )
+{
+	if( pFirst->High != pSecond->High ) return (pFirst->High < pSecond->High) ? -1 : 1;
+	if( pFirst->Low != pSecond->Low ) return (pFirst->Low < pSecond->Low) ? -1 : 1;
+	if( pFirst->Suffix != pSecond->Suffix ) return (pFirst->Suffix < pSecond->Suffix) ? -1 : 1;
+
+	return 0;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: SortNodesByVersion
+//
+//  Desc: Merge sorts a Next-linked run of nodes by version key. The sort is
+//        stable, so entries with the same version stay in name order.
+// ----------------------------------------------------------------------------
+PSOFTWARE_DATA_NODE SortNodesByVersion( PSOFTWARE_DATA_NODE pHead )
+{
+	PSOFTWARE_DATA_NODE pSlow, pFast, pSecond;
+	PSOFTWARE_DATA_NODE* ppTail;
+	PSOFTWARE_DATA_NODE pMerged = NULL;
+
+	if( (NULL == pHead) || (NULL == pHead->Next) ) return pHead;
+
+	// Split the run in half.
+	pSlow = pHead;
+	pFast = pHead->Next;
+
+	while( pFast && pFast->Next )
+	{
+		pSlow = pSlow->Next;
+		pFast = pFast->Next->Next;
+	}
+
+	pSecond = pSlow->Next;
+	pSlow->Next = NULL;
+
+	pHead = SortNodesByVersion( pHead );
+	pSecond = SortNodesByVersion( pSecond );
+
+	ppTail = &pMerged;
+
+	while( pHead && pSecond )
+	{
+		if( CompareVersionKeys( &pSecond->Data.VersionKey, &pHead->Data.VersionKey ) < 0 )
+		{
+			*ppTail = pSecond;
+			pSecond = pSecond->Next;
+		}
+		else
+		{
+			*ppTail = pHead;
+			pHead = pHead->Next;
+		}
+
+		ppTail = &(*ppTail)->Next;
+	}
+
+	*ppTail = pHead ? pHead : pSecond;
+
+	return pMerged;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: SortSoftwareListByVersion
+//
+//  Desc: Reorders the software list from oldest to newest version.
+// ----------------------------------------------------------------------------
+void SortSoftwareListByVersion()
+{
+	PSOFTWARE_DATA_NODE pCurrent, pPrevious = NULL;
+
+	g_pSoftwareListHead = SortNodesByVersion( g_pSoftwareListHead );
+
+	// Repair the back links and the tail.
+	for( pCurrent = g_pSoftwareListHead; pCurrent; pCurrent = pCurrent->Next )
+	{
+		pCurrent->Previous = pPrevious;
+		pPrevious = pCurrent;
+	}
+
+	g_pSoftwareListTail = pPrevious;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: FilterSoftwareListOlderThan
+//
+//  Desc: Removes every entry that is not older than the given version.
+//        Entries with an unknown version are removed as well.
+// ----------------------------------------------------------------------------
+void FilterSoftwareListOlderThan( const VERSION_KEY* pLimit )
+{
+	PSOFTWARE_DATA_NODE pCurrent, pNext;
+
+	for( pCurrent = g_pSoftwareListHead; pCurrent; pCurrent = pNext )
+	{
+		pNext = pCurrent->Next;
+
+		if( IsVersionKnown( &pCurrent->Data.VersionKey ) &&
+			(CompareVersionKeys( &pCurrent->Data.VersionKey, pLimit ) < 0) ) continue;
+
+		if( pCurrent->Previous ) pCurrent->Previous->Next = pNext;
+		else g_pSoftwareListHead = pNext;
+
+		if( pNext ) pNext->Previous = pCurrent->Previous;
+		else g_pSoftwareListTail = pCurrent->Previous;
+
+		HeapFree( g_hProcessHeap, NULL, pCurrent );
+	}
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: MergeLists
+//
+//  Desc: Merges the second software list into the first for a more
+//        comprehensive list of installed software. Products are joined to
+//        Uninstall entries by product code using a hash table built over
+//        the first list, so each list is only walked once.
+// ----------------------------------------------------------------------------
+void MergeLists()
+{
+	PSOFTWARE_DATA_NODE pCurrent, pMatch;
+	PSOFTWARE_DATA_NODE pNew;
+	PSOFTWARE_DATA_NODE* pBuckets = NULL;
+	DWORD nBuckets = 16;
+	DWORD nEntries = 0;
+	DWORD nBucket;
+
+	// Size the table to the number of keyed entries in the first list.
+	for( pCurrent = g_pSoftwareListHead; pCurrent; pCurrent = pCurrent->Next )
+	{
+		if( pCurrent->Data.ProductCode[0] ) nEntries++;
+	}
+
+	while( nBuckets < nEntries * 2 ) nBuckets <<= 1;
+
+	pBuckets = (PSOFTWARE_DATA_NODE*)HeapAlloc( g_hProcessHeap,
+												HEAP_ZERO_MEMORY,
+												sizeof(PSOFTWARE_DATA_NODE) * nBuckets );
+	if( NULL == pBuckets )
+	{
+		_ftprintf( stderr, TEXT("Out of memory.\n") );
+		return;
+	}
+
+	// Build side: chain every Uninstall entry with a product code into its
+	// bucket.
+	for( pCurrent = g_pSoftwareListHead; pCurrent; pCurrent = pCurrent->Next )
+	{
+		if( !pCurrent->Data.ProductCode[0] ) continue;
+
+		nBucket = HashString( pCurrent->Data.ProductCode ) & (nBuckets - 1);
+
+		pCurrent->HashNext = pBuckets[nBucket];
+		pBuckets[nBucket] = pCurrent;
+	}
+
+	// Probe side: look up each Products entry by its decoded product code.
+	for( pCurrent = g_pSoftwareListHead2; pCurrent; pCurrent = pCurrent->Next )
+	{
+		pMatch = NULL;
+
+		if( pCurrent->Data.ProductCode[0] )
+		{
+			nBucket = HashString( pCurrent->Data.ProductCode ) & (nBuckets - 1);
+
+			for( pMatch = pBuckets[nBucket]; pMatch; pMatch = pMatch->HashNext )
+			{
+				if( _tcscmp( pMatch->Data.ProductCode, pCurrent->Data.ProductCode ) == 0 ) break;
+			}
+		}
+
+		if( pMatch )
+		{
+			// The Uninstall record wins, but fill in a missing version from
+			// the packed Version value.
+			if( (_tcscmp( pMatch->Data.DisplayVersion, TEXT("N/A") ) == 0) &&
+				(_tcscmp( pCurrent->Data.DisplayVersion, TEXT("N/A") ) != 0) )
+			{
+				StringCchCopy( pMatch->Data.DisplayVersion, VERSION_LENGTH, pCurrent->Data.DisplayVersion );
+				pMatch->Data.VersionKey = pCurrent->Data.VersionKey;
+			}
+
+			continue;
+		}
+
+		// Create a new list node.
+		pNew = (PSOFTWARE_DATA_NODE)HeapAlloc( g_hProcessHeap,
+											   HEAP_ZERO_MEMORY,
+											   sizeof(SOFTWARE_DATA_NODE) );
+		if( NULL == pNew )
+		{
+			_ftprintf( stderr, TEXT("Out of memory.\n") );
+			break;
+		}
+
+		pNew->Data = pCurrent->Data;
+
+		AddNodeToList( pNew );
+	}
+
+	HeapFree( g_hProcessHeap, NULL, pBuckets );
+}
+
+
+// ----------------------------------------------------------------------------
+//  Software key schemas.
+//
+//  Each schema names a root key, the values to pull out of every subkey
+//  under it, the SOFTWARE_DATA field each one lands in and the text stored
+//  when an optional value is missing. QuerySubkey and EnumerateSoftwareKey
+//  are instantiated once per schema, so adding a value is a new table row
+//  rather than another RegQueryValueEx call.
+// ----------------------------------------------------------------------------
+struct UNINSTALL_SCHEMA
+{
+	static const TCHAR* const	RootKey;
+	static const VALUE_SCHEMA	Values[];
+	static const DWORD			ValueCount;
+
+	static void ParseKeyName( const TCHAR* sKey, DWORD nKeyLength, TCHAR* sProductCode )
+	{
+		// MSI installs are keyed by their {GUID} product code.
+		ParseProductCode( sKey, nKeyLength, sProductCode );
+	}
+
+	static void AddNode( PSOFTWARE_DATA_NODE pNode ) { AddNodeToList( pNode ); }
+};
+
+const TCHAR* const UNINSTALL_SCHEMA::RootKey = TEXT(SOFTWARE_LIST_KEY);
+
+const VALUE_SCHEMA UNINSTALL_SCHEMA::Values[] =
+{
+	{ TEXT("DisplayName"),		VALUE_STRING,	SCHEMA_FIELD(DisplayName),		TRUE,	NULL },
+	{ TEXT("InstallDate"),		VALUE_STRING,	SCHEMA_FIELD(InstallDate),		FALSE,	TEXT("N/A") },
+	{ TEXT("DisplayVersion"),	VALUE_STRING,	SCHEMA_FIELD(DisplayVersion),	FALSE,	TEXT("N/A") },
+};
+
+const DWORD UNINSTALL_SCHEMA::ValueCount = sizeof(UNINSTALL_SCHEMA::Values) / sizeof(VALUE_SCHEMA);
+
+struct PRODUCTS_SCHEMA
+{
+	static const TCHAR* const	RootKey;
+	static const VALUE_SCHEMA	Values[];
+	static const DWORD			ValueCount;
+
+	static void ParseKeyName( const TCHAR* sKey, DWORD nKeyLength, TCHAR* sProductCode )
+	{
+		// The subkey name is the packed form of the product code.
+		DecodePackedGuid( sKey, nKeyLength, sProductCode );
+	}
+
+	static void AddNode( PSOFTWARE_DATA_NODE pNode ) { AddNodeToList2( pNode ); }
+};
+
+const TCHAR* const PRODUCTS_SCHEMA::RootKey = TEXT(SOFTWARE_LIST_KEY2);
+
+const VALUE_SCHEMA PRODUCTS_SCHEMA::Values[] =
+{
+	{ TEXT("ProductName"),		VALUE_STRING,			SCHEMA_FIELD(DisplayName),		TRUE,	NULL },
+	{ TEXT("InstallDate"),		VALUE_STRING,			SCHEMA_FIELD(InstallDate),		FALSE,	TEXT("N/A") },
+	{ TEXT("Version"),			VALUE_PACKED_VERSION,	SCHEMA_FIELD(DisplayVersion),	FALSE,	TEXT("N/A") },
+};
+
+const DWORD PRODUCTS_SCHEMA::ValueCount = sizeof(PRODUCTS_SCHEMA::Values) / sizeof(VALUE_SCHEMA);
+
+
+// ----------------------------------------------------------------------------
+//  Name: FormatValue
+//
+//  Desc: Stores raw registry value data into a SOFTWARE_DATA field as
+//        described by its schema entry. Returns FALSE if the data has a
+//        type the entry cannot use.
+// ----------------------------------------------------------------------------
+BOOL FormatValue( const VALUE_SCHEMA& schema,
+				  PSOFTWARE_DATA pData,
+				  DWORD nType,
+				  const BYTE* pValue,
+				  DWORD nValueSize )
+{
+	TCHAR* sField = (TCHAR*)((BYTE*)pData + schema.FieldOffset);
+	DWORD nValue;
+
+	switch( schema.Kind )
+	{
+	case VALUE_STRING:
+		if( (REG_SZ == nType) || (REG_EXPAND_SZ == nType) )
+		{
+			// Registry strings are not guaranteed to be terminated.
+			StringCchCopyN( sField,
+							schema.FieldLength,
+							(const TCHAR*)pValue,
+							nValueSize / sizeof(TCHAR) );
+			return TRUE;
+		}
+
+		if( (REG_DWORD == nType) && (sizeof(DWORD) == nValueSize) )
+		{
+			StringCchPrintf( sField, schema.FieldLength, TEXT("%u"), *(const DWORD*)pValue );
+			return TRUE;
+		}
+
+		return FALSE;
+
+	case VALUE_PACKED_VERSION:
+		if( (REG_DWORD != nType) || (sizeof(DWORD) != nValueSize) ) return FALSE;
+
+		// The version is packed as major.minor.build in a DWORD.
+		nValue = *(const DWORD*)pValue;
+
+		StringCchPrintf( sField,
+						 schema.FieldLength,
+						 TEXT("%u.%u.%u"),
+						 (nValue >> 24) & 0xFF,
+						 (nValue >> 16) & 0xFF,
+						 nValue & 0xFFFF );
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: QuerySubkey
+//
+//  Desc: Queries the information for a software subkey and adds it to the
+//        list selected by the schema. All values are read in a single
+//        enumeration pass and matched against the schema table.
+// ----------------------------------------------------------------------------
+template< class Schema >
+void QuerySubkey( HKEY hParentKey, TCHAR* sKey, DWORD nKeyLength )
+{
+	TCHAR sValueName[MAX_VALUE_NAME_LENGTH];
+	PBYTE pValue = NULL;
+	DWORD nValueNameSize;
+	DWORD nValueSize;
+	DWORD nType;
+	DWORD nFound = 0;
+	DWORD nRequired = 0;
+	HKEY hSubkey = NULL;
+	LONG result = ERROR_SUCCESS;
+	PSOFTWARE_DATA_NODE pNew = NULL;
+
+	// Allocate memory for the buffer to contain the value data, with room
+	// for a terminator.
+	pValue = (PBYTE)HeapAlloc( g_hProcessHeap,
+							   HEAP_ZERO_MEMORY,
+							   MAX_VALUE_LENGTH + sizeof(TCHAR) );
+	if( NULL == pValue )
+	{
+		_ftprintf( stderr, TEXT("Out of memory.\n") );
+		goto done;
+	}
+
+	// Create a new list node.
+	pNew = (PSOFTWARE_DATA_NODE)HeapAlloc( g_hProcessHeap,
+										   HEAP_ZERO_MEMORY,
+										   sizeof(SOFTWARE_DATA_NODE) );
+	if( NULL == pNew )
+	{
+		_ftprintf( stderr, TEXT("Out of memory.\n") );
+		goto done;
+	}
+
+	// Open the specific software key.
+	result = RegOpenKeyEx( hParentKey,
+						   sKey,
+						   0,
+						   KEY_READ,
+						   &hSubkey );
+	if( ERROR_SUCCESS != result )
+	{
+		_ftprintf( stderr, TEXT("Unable to open the required registry key!\n") );
+		goto done;
+	}
+
+	for( DWORD i = 0; i < Schema::ValueCount; i++ )
+	{
+		if( Schema::Values[i].Required ) nRequired |= (1 << i);
+	}
+
+	// Walk every value of the subkey once, keeping the ones the schema asks
+	// for. Names or data too large for the buffers are skipped, the same as
+	// a value that is not present.
+	for( DWORD nIndex = 0; ; nIndex++ )
+	{
+		nValueNameSize = MAX_VALUE_NAME_LENGTH;
+		nValueSize = MAX_VALUE_LENGTH;
+
+		result = RegEnumValue( hSubkey,
+							   nIndex,
+							   sValueName,
+							   &nValueNameSize,
+							   NULL,
+							   &nType,
+							   pValue,
+							   &nValueSize );
+		if( ERROR_NO_MORE_ITEMS == result ) break;
+		if( ERROR_SUCCESS != result ) continue;
+
+		for( DWORD i = 0; i < Schema::ValueCount; i++ )
+		{
+			if( nFound & (1 << i) ) continue;
+
+			// Value names are identifiers, so they are matched without
+			// regard to the user's locale.
+			if( CompareStringOrdinal( sValueName,
+									  nValueNameSize,
+									  Schema::Values[i].ValueName,
+									  -1,
+									  TRUE ) != CSTR_EQUAL ) continue;
+
+			if( FormatValue( Schema::Values[i], &pNew->Data, nType, pValue, nValueSize ) )
+			{
+				nFound |= (1 << i);
+			}
+
+			break;
+		}
+	}
+
+	result = ERROR_SUCCESS;
+
+	// Entries missing a required value are not software we can list.
+	if( (nFound & nRequired) != nRequired )
+	{
+		result = ERROR_FILE_NOT_FOUND;
+		goto done;
+	}
+
+	// Optional values that are missing take the default from their row.
+	for( DWORD i = 0; i < Schema::ValueCount; i++ )
+	{
+		const VALUE_SCHEMA& schema = Schema::Values[i];
+
+		if( (nFound & (1 << i)) || (NULL == schema.Default) ) continue;
+
+		StringCchCopy( (TCHAR*)((BYTE*)&pNew->Data + schema.FieldOffset),
+					   schema.FieldLength,
+					   schema.Default );
+	}
+
+	Schema::ParseKeyName( sKey, nKeyLength, pNew->Data.ProductCode );
+	ParseVersionKey( pNew->Data.DisplayVersion, &pNew->Data.VersionKey );
+	Schema::AddNode( pNew );
+
+done:
+	if( ERROR_SUCCESS != result )
+	{
+		if( pNew ) HeapFree( g_hProcessHeap, NULL, pNew );
+	}
+
+	if( hSubkey ) RegCloseKey( hSubkey );
+	if( pValue ) HeapFree( g_hProcessHeap, NULL, pValue );
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: EnumerateSoftwareKey
+//
+//  Desc: Enumerates the subkeys of the schema's root key and retrieves the
+//        software information from each one.
+// ----------------------------------------------------------------------------
+template< class Schema >
+LONG EnumerateSoftwareKey()
+{
+	TCHAR* sSubkeyName = NULL;
+	DWORD nSubkeyNameSize;
+	DWORD nNumberOfSubkeys;
+	HKEY hSoftwareListKey = NULL;
+	LONG result = ERROR_SUCCESS;
+
+	// Open the appropriate registry key to enumerate the list of installed
+	// software.
+	result = RegOpenKeyEx( g_hBaseKey,
+						   Schema::RootKey,
+						   0,
+						   KEY_READ,
+						   &hSoftwareListKey );
+	if( ERROR_SUCCESS != result )
+	{
+		_ftprintf( stderr, TEXT("Unable to open the required registry key!\n") );
+		goto done;
+	}
+
+	// Query the information about this key to get the number of subkeys
+	// and the length of the longest-named subkey.
+	result = RegQueryInfoKey( hSoftwareListKey,
+							  NULL,
+							  NULL,
+							  NULL,
+							  &nNumberOfSubkeys,
+							  &nSubkeyNameSize,
+							  NULL,
+							  NULL,
+							  NULL,
+							  NULL,
+							  NULL,
+							  NULL );
+	if( ERROR_SUCCESS != result )
+	{
+		_ftprintf( stderr, TEXT("Unable to query information about the key, %s\n"), Schema::RootKey );
+		goto done;
+	}
+
+	sSubkeyName = (TCHAR*)HeapAlloc( g_hProcessHeap,
+									 HEAP_ZERO_MEMORY,
+									 sizeof(TCHAR) * (MAX_KEY_LENGTH + 1) );
+	if( NULL == sSubkeyName )
+	{
+		_ftprintf( stderr, TEXT("Out of memory error when creating sSubkeyName.\n") );
+		result = ERROR_OUTOFMEMORY;
+		goto done;
+	}
+
+	// Enumerate the list of subkeys and retrieve the software information
+	// from each one.
+	for( DWORD i = 0; i < nNumberOfSubkeys; i++ )
+	{
+		nSubkeyNameSize = MAX_KEY_LENGTH;
+
+		result = RegEnumKeyEx( hSoftwareListKey,
+							   i,
+							   sSubkeyName,
+							   &nSubkeyNameSize,
+							   NULL,
+							   NULL,
+							   NULL,
+							   NULL );
+		if( ERROR_SUCCESS == result )
+		{
+			QuerySubkey<Schema>( hSoftwareListKey, sSubkeyName, nSubkeyNameSize );
+		}
+	}
+
+	result = ERROR_SUCCESS;
+
+done:
+	if( sSubkeyName ) HeapFree( g_hProcessHeap, NULL, sSubkeyName );
+	if( hSoftwareListKey ) RegCloseKey( hSoftwareListKey );
+
+	return result;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: CollectFakeSoftwareLists
+//
+//  Desc: Stands in for the registry of a host when load testing fleet runs.
+//        After the configured latency it builds a list of synthetic records
+//        seeded from the host name, so every run sees the same data. One
+//        host in eight takes eight times as long and one in 32 fails, so
+//        work stealing and the failure path are exercised too.
+// ----------------------------------------------------------------------------
+LONG CollectFakeSoftwareLists( const TCHAR* sComputerName )
+{
+	TCHAR sKey[COMPUTER_NAME_LENGTH];
+	PSOFTWARE_DATA_NODE pNew;
+	DWORD nSeed;
+	DWORD nCount;
+
+	StringCchCopy( sKey, COMPUTER_NAME_LENGTH, sComputerName );
+	CharUpperBuff( sKey, (DWORD)_tcslen( sKey ) );
+
+	nSeed = HashString( sKey );
+
+	Sleep( (0 == (nSeed & 7)) ? g_nFakeLatency * 8 : g_nFakeLatency );
+
+	if( 0 == ((nSeed >> 3) & 31) ) return ERROR_ACCESS_DENIED;
+
+	nCount = 20 + (nSeed >> 8) % 100;
+
+	for( DWORD i = 0; i < nCount; i++ )
+	{
+		nSeed = nSeed * 1103515245 + 12345;
+
+		pNew = (PSOFTWARE_DATA_NODE)HeapAlloc( g_hProcessHeap,
+											   HEAP_ZERO_MEMORY,
+											   sizeof(SOFTWARE_DATA_NODE) );
+		if( NULL == pNew )
+		{
+			_ftprintf( stderr, TEXT("Out of memory.\n") );
+			return ERROR_OUTOFMEMORY;
+		}
+
+		StringCchPrintf( pNew->Data.DisplayName,
+						 DISPLAY_NAME_LENGTH,
+						 TEXT("Synthetic Product %u"),
+						 (nSeed >> 16) % 1000 );
+
+		StringCchPrintf( pNew->Data.InstallDate,
+						 INSTALL_DATE_LENGTH,
+						 TEXT("20%02u%02u%02u"),
+						 10 + (nSeed >> 12) % 15,
+						 1 + (nSeed >> 8) % 12,
+						 1 + (nSeed >> 4) % 28 );
+
+		if( 0 == (nSeed & 15) )
+		{
+			StringCchCopy( pNew->Data.DisplayVersion, VERSION_LENGTH, TEXT("N/A") );
+		}
+		else
+		{
+			StringCchPrintf( pNew->Data.DisplayVersion,
+							 VERSION_LENGTH,
+							 TEXT("%u.%u.%u"),
+							 (nSeed >> 24) % 20,
+							 (nSeed >> 20) % 10,
+							 (nSeed >> 4) % 10000 );
+		}
+
+		ParseVersionKey( pNew->Data.DisplayVersion, &pNew->Data.VersionKey );
+		AddNodeToList( pNew );
+	}
+
+	return ERROR_SUCCESS;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: CollectSoftwareLists
+//
+//  Desc: Connects to the computer's registry and builds the merged
+//        software list for it, filtered and ordered as requested.
+// ----------------------------------------------------------------------------
+LONG CollectSoftwareLists( const TCHAR* sComputerName, BOOL bRemoteComputer )
+{
+	LONG result = ERROR_SUCCESS;
+
+	g_hBaseKey = HKEY_LOCAL_MACHINE;
+
+	if( g_bFakeRegistry )
+	{
+		result = CollectFakeSoftwareLists( sComputerName );
+		if( ERROR_SUCCESS != result ) return result;
+
+		bRemoteComputer = FALSE;
+		goto order;
+	}
+
+	if( bRemoteComputer )
+	{
+		// Connect to the registry on the remote computer.
+		result = RegConnectRegistry( sComputerName,
+									 HKEY_LOCAL_MACHINE,
+									 &g_hBaseKey );
+		if( ERROR_SUCCESS != result )
+		{
+			_ftprintf( stderr,
+					   TEXT("Failed to connect to the remote registry on %s\n"),
+					   sComputerName );
+
+			g_hBaseKey = HKEY_LOCAL_MACHINE;
+			return result;
+		}
+	}
+
+	result = EnumerateSoftwareKey<UNINSTALL_SCHEMA>();
+	if( ERROR_SUCCESS != result ) goto done;
+
+	result = EnumerateSoftwareKey<PRODUCTS_SCHEMA>();
+	if( ERROR_SUCCESS != result ) goto done;
+
+	MergeLists();
+
+order:
+	if( g_sOlderThan ) FilterSoftwareListOlderThan( &g_tOlderThan );
+	if( g_bSortByVersion ) SortSoftwareListByVersion();
+
+done:
+	if( bRemoteComputer ) RegCloseKey( g_hBaseKey );
+
+	g_hBaseKey = HKEY_LOCAL_MACHINE;
+
+	return result;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: DisplaySoftwareReport
+//
+//  Desc: Displays the table header followed by the software list, or just
+//        the encoded rows for the CSV and JSON formats.
+// ----------------------------------------------------------------------------
+void DisplaySoftwareReport( FILE* hFile, const TCHAR* sComputerName )
+{
+	if( OUTPUT_TEXT != g_nOutputFormat )
+	{
+		DisplaySoftwareListEncoded( hFile, sComputerName );
+		return;
+	}
+
+	_ftprintf( hFile, TEXT("Computer name: %s\n"), sComputerName );
+	_ftprintf( hFile, TEXT("------------------------------------\n\n") );
+	_ftprintf( hFile, TEXT("%-20sProgram Name\n\n"), TEXT("Install Date") );
+
+	DisplaySoftwareList( hFile );
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: AppendFleetOutput
+//
+//  Desc: Appends bytes read from a worker to a host's output buffer,
+//        growing the buffer as needed.
+// ----------------------------------------------------------------------------
+BOOL AppendFleetOutput( PFLEET_HOST pHost, const BYTE* pData, DWORD nSize )
+{
+	PBYTE pNew;
+	DWORD nCapacity;
+
+	if( pHost->OutputSize + nSize > pHost->OutputCapacity )
+	{
+		nCapacity = pHost->OutputCapacity ? pHost->OutputCapacity : FLEET_READ_SIZE;
+
+		while( nCapacity < pHost->OutputSize + nSize ) nCapacity *= 2;
+
+		if( pHost->Output )
+		{
+			pNew = (PBYTE)HeapReAlloc( g_hProcessHeap, 0, pHost->Output, nCapacity );
+		}
+		else
+		{
+			pNew = (PBYTE)HeapAlloc( g_hProcessHeap, 0, nCapacity );
+		}
+
+		if( NULL == pNew ) return FALSE;
+
+		pHost->Output = pNew;
+		pHost->OutputCapacity = nCapacity;
+	}
+
+	CopyMemory( pHost->Output + pHost->OutputSize, pData, nSize );
+	pHost->OutputSize += nSize;
+
+	return TRUE;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: FindFleetTerminator
+//
+//  Desc: Looks for the end-of-host marker a worker writes after each report.
+//        The marker is a record separator, the result code and a newline,
+//        and is always the last thing in the buffer. Returns the offset of
+//        the marker, or -1 if the report is not complete yet.
+// ----------------------------------------------------------------------------
+LONG FindFleetTerminator( PFLEET_HOST pHost, LONG* pResult )
+{
+	DWORD nEnd = pHost->OutputSize;
+	DWORD nStart;
+
+	if( (0 == nEnd) || ('\n' != pHost->Output[nEnd - 1]) ) return -1;
+
+	// The marker is short, so only the tail of the buffer is searched.
+	nStart = (nEnd > 16) ? nEnd - 16 : 0;
+
+	for( DWORD i = nEnd - 1; i > nStart; i-- )
+	{
+		if( FLEET_TERMINATOR != pHost->Output[i - 1] ) continue;
+
+		if( (i - 1 > 0) && ('\n' != pHost->Output[i - 2]) ) return -1;
+
+		*pResult = strtol( (const char*)pHost->Output + i, NULL, 10 );
+
+		return (LONG)(i - 1);
+	}
+
+	return -1;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: InitializeCrcTable
+//
+//  Desc: Builds the lookup table for the CRC-32 used by the journal.
+// ----------------------------------------------------------------------------
+void InitializeCrcTable()
+{
+	DWORD nValue;
+
+	for( DWORD i = 0; i < 256; i++ )
+	{
+		nValue = i;
+
+		for( int j = 0; j < 8; j++ )
+		{
+			nValue = (nValue & 1) ? (0xEDB88320 ^ (nValue >> 1)) : (nValue >> 1);
+		}
+
+		g_nCrcTable[i] = nValue;
+	}
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: UpdateCrc
+//
+//  Desc: Continues a CRC-32 over another block of data. Start with 0.
+// ----------------------------------------------------------------------------
+DWORD UpdateCrc( DWORD nCrc, const BYTE* pData, DWORD nSize )
+{
+	nCrc = ~nCrc;
+
+	for( DWORD i = 0; i < nSize; i++ )
+	{
+		nCrc = g_nCrcTable[(nCrc ^ pData[i]) & 0xFF] ^ (nCrc >> 8);
+	}
+
+	return ~nCrc;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: ChecksumJournalRecord
+//
+//  Desc: Computes the checksum of a journal record: the header with the
+//        checksum field zeroed, then the computer name and the report.
+// ----------------------------------------------------------------------------
+DWORD ChecksumJournalRecord( const JOURNAL_RECORD* pRecord, const BYTE* pName, const BYTE* pOutput )
+{
+	JOURNAL_RECORD tHeader = *pRecord;
+	DWORD nCrc;
+
+	tHeader.Checksum = 0;
+
+	nCrc = UpdateCrc( 0, (const BYTE*)&tHeader, sizeof(tHeader) );
+	nCrc = UpdateCrc( nCrc, pName, pRecord->NameSize );
+	nCrc = UpdateCrc( nCrc, pOutput, pRecord->OutputSize );
+
+	return nCrc;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: SetJournalOptions
+//
+//  Desc: Records the options that shape a report in a journal record: the
+//        output format, the sort order and the /v version, if any.
+// ----------------------------------------------------------------------------
+void SetJournalOptions( PJOURNAL_RECORD pRecord )
+{
+	pRecord->Format = g_nOutputFormat;
+	pRecord->Options = 0;
+	pRecord->OlderThan.High = 0;
+	pRecord->OlderThan.Low = 0;
+	pRecord->OlderThan.Suffix = 0;
+
+	if( g_bSortByVersion ) pRecord->Options |= JOURNAL_SORT_BY_VERSION;
+
+	if( g_sOlderThan )
+	{
+		pRecord->Options |= JOURNAL_OLDER_THAN;
+		pRecord->OlderThan = g_tOlderThan;
+	}
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: AppendJournalRecord
+//
+//  Desc: Appends a finished host and its report to the journal. The record
+//        goes out in one write on a write-through handle, so it is on disk
+//        before the next host is handed out. A report larger than a resumed
+//        run would read back is left out, and the host is collected again.
+// ----------------------------------------------------------------------------
+void AppendJournalRecord( PFLEET_HOST pHost )
+{
+	JOURNAL_RECORD tRecord;
+	PBYTE pBuffer;
+	DWORD nSize;
+	DWORD nBytes;
+
+	if( pHost->OutputSize > JOURNAL_MAX_OUTPUT )
+	{
+		_ftprintf( stderr, TEXT("The report for %s is too large to journal.\n"), pHost->ComputerName );
+		return;
+	}
+
+	tRecord.Magic = JOURNAL_MAGIC;
+	SetJournalOptions( &tRecord );
+	tRecord.NameSize = (DWORD)(_tcslen( pHost->ComputerName ) * sizeof(TCHAR));
+	tRecord.OutputSize = pHost->OutputSize;
+	tRecord.Checksum = ChecksumJournalRecord( &tRecord,
+											  (const BYTE*)pHost->ComputerName,
+											  pHost->Output );
+
+	nSize = sizeof(tRecord) + tRecord.NameSize + tRecord.OutputSize;
+
+	pBuffer = (PBYTE)HeapAlloc( g_hProcessHeap, 0, nSize );
+	if( NULL == pBuffer )
+	{
+		_ftprintf( stderr, TEXT("Out of memory writing the journal entry for %s.\n"), pHost->ComputerName );
+		return;
+	}
+
+	CopyMemory( pBuffer, &tRecord, sizeof(tRecord) );
+	CopyMemory( pBuffer + sizeof(tRecord), pHost->ComputerName, tRecord.NameSize );
+	CopyMemory( pBuffer + sizeof(tRecord) + tRecord.NameSize, pHost->Output, tRecord.OutputSize );
+
+	EnterCriticalSection( &g_csJournal );
+
+	if( !WriteFile( g_hJournal, pBuffer, nSize, &nBytes, NULL ) || (nBytes != nSize) )
+	{
+		_ftprintf( stderr, TEXT("Failed to write the journal entry for %s.\n"), pHost->ComputerName );
+	}
+
+	LeaveCriticalSection( &g_csJournal );
+
+	HeapFree( g_hProcessHeap, NULL, pBuffer );
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: ReadJournalBytes
+//
+//  Desc: Reads exactly nSize bytes from the journal. Returns FALSE at the
+//        end of the file or on a short read.
+// ----------------------------------------------------------------------------
+BOOL ReadJournalBytes( LPVOID pBuffer, DWORD nSize )
+{
+	DWORD nBytes;
+
+	if( 0 == nSize ) return TRUE;
+
+	return ReadFile( g_hJournal, pBuffer, nSize, &nBytes, NULL ) && (nBytes == nSize);
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: FindFleetHost
+//
+//  Desc: Looks up a host that is not done yet by name in the host index.
+//        Returns -1 if there is none.
+// ----------------------------------------------------------------------------
+LONG FindFleetHost( const LONG* pIndex, DWORD nIndexSize, const TCHAR* sComputerName )
+{
+	TCHAR sKey[COMPUTER_NAME_LENGTH];
+	DWORD nSlot;
+	LONG nHost;
+
+	StringCchCopy( sKey, COMPUTER_NAME_LENGTH, sComputerName );
+	CharUpperBuff( sKey, (DWORD)_tcslen( sKey ) );
+
+	for( nSlot = HashString( sKey ) & (nIndexSize - 1);
+		 (nHost = pIndex[nSlot]) >= 0;
+		 nSlot = (nSlot + 1) & (nIndexSize - 1) )
+	{
+		if( g_pFleetHosts[nHost].Done ) continue;
+
+		if( CompareString( LOCALE_USER_DEFAULT,
+						   NORM_IGNORECASE,
+						   g_pFleetHosts[nHost].ComputerName,
+						   -1,
+						   sComputerName,
+						   -1 ) == CSTR_EQUAL ) return nHost;
+	}
+
+	return -1;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: LoadFleetJournal
+//
+//  Desc: Replays the journal of an earlier run, marking every host it holds
+//        as done with its saved report if the report was made with the same
+//        options as this run. Reading stops at the first record that is
+//        short or fails its checksum, which is where an interrupted write
+//        left a torn tail, and the file is cut back to the last good record
+//        so new records follow it.
+// ----------------------------------------------------------------------------
+LONG LoadFleetJournal()
+{
+	TCHAR sComputerName[COMPUTER_NAME_LENGTH];
+	JOURNAL_RECORD tRecord;
+	JOURNAL_RECORD tOptions;
+	LONG* pIndex = NULL;
+	PBYTE pOutput;
+	DWORD nIndexSize = 16;
+	DWORD nSlot;
+	DWORD nResumed = 0;
+	LONG nHost;
+	LARGE_INTEGER nGood;
+	LARGE_INTEGER nEnd;
+
+	// Index the host list by upper case name.
+	while( nIndexSize < g_nFleetHosts * 2 ) nIndexSize <<= 1;
+
+	pIndex = (LONG*)HeapAlloc( g_hProcessHeap, 0, sizeof(LONG) * nIndexSize );
+	if( NULL == pIndex )
+	{
+		_ftprintf( stderr, TEXT("Out of memory.\n") );
+		return ERROR_OUTOFMEMORY;
+	}
+
+	for( DWORD i = 0; i < nIndexSize; i++ ) pIndex[i] = -1;
+
+	for( DWORD i = 0; i < g_nFleetHosts; i++ )
+	{
+		StringCchCopy( sComputerName, COMPUTER_NAME_LENGTH, g_pFleetHosts[i].ComputerName );
+		CharUpperBuff( sComputerName, (DWORD)_tcslen( sComputerName ) );
+
+		nSlot = HashString( sComputerName ) & (nIndexSize - 1);
+		while( pIndex[nSlot] >= 0 ) nSlot = (nSlot + 1) & (nIndexSize - 1);
+
+		pIndex[nSlot] = (LONG)i;
+	}
+
+	SetJournalOptions( &tOptions );
+
+	nGood.QuadPart = 0;
+
+	for( ;; )
+	{
+		pOutput = NULL;
+
+		if( !ReadJournalBytes( &tRecord, sizeof(tRecord) ) ) break;
+
+		if( (JOURNAL_MAGIC != tRecord.Magic) ||
+			(tRecord.NameSize >= sizeof(sComputerName)) ||
+			(tRecord.NameSize % sizeof(TCHAR)) ||
+			(tRecord.OutputSize > JOURNAL_MAX_OUTPUT) ) break;
+
+		if( !ReadJournalBytes( sComputerName, tRecord.NameSize ) ) break;
+
+		sComputerName[tRecord.NameSize / sizeof(TCHAR)] = TEXT('\0');
+
+		if( tRecord.OutputSize )
+		{
+			pOutput = (PBYTE)HeapAlloc( g_hProcessHeap, 0, tRecord.OutputSize );
+			if( NULL == pOutput ) break;
+
+			if( !ReadJournalBytes( pOutput, tRecord.OutputSize ) ) break;
+		}
+
+		if( ChecksumJournalRecord( &tRecord, (const BYTE*)sComputerName, pOutput ) != tRecord.Checksum ) break;
+
+		nGood.QuadPart += sizeof(tRecord) + tRecord.NameSize + tRecord.OutputSize;
+
+		// Reports saved with another format, sort order or /v version are
+		// collected again.
+		nHost = ((tOptions.Format == tRecord.Format) &&
+				 (tOptions.Options == tRecord.Options) &&
+				 (CompareVersionKeys( &tOptions.OlderThan, &tRecord.OlderThan ) == 0)) ?
+			FindFleetHost( pIndex, nIndexSize, sComputerName ) : -1;
+
+		if( nHost < 0 )
+		{
+			if( pOutput ) HeapFree( g_hProcessHeap, NULL, pOutput );
+			continue;
+		}
+
+		g_pFleetHosts[nHost].Output = pOutput;
+		g_pFleetHosts[nHost].OutputSize = tRecord.OutputSize;
+		g_pFleetHosts[nHost].OutputCapacity = tRecord.OutputSize;
+		g_pFleetHosts[nHost].Result = ERROR_SUCCESS;
+		g_pFleetHosts[nHost].Done = TRUE;
+
+		nResumed++;
+	}
+
+	if( pOutput ) HeapFree( g_hProcessHeap, NULL, pOutput );
+	HeapFree( g_hProcessHeap, NULL, pIndex );
+
+	// Drop the torn tail, if any, and append after the last good record.
+	nEnd.QuadPart = 0;
+	GetFileSizeEx( g_hJournal, &nEnd );
+
+	if( nEnd.QuadPart != nGood.QuadPart )
+	{
+		_ftprintf( stderr,
+				   TEXT("Discarding %I64d bytes of incomplete journal data.\n"),
+				   nEnd.QuadPart - nGood.QuadPart );
+	}
+
+	if( !SetFilePointerEx( g_hJournal, nGood, NULL, FILE_BEGIN ) || !SetEndOfFile( g_hJournal ) )
+	{
+		_ftprintf( stderr, TEXT("Unable to truncate the journal.\n") );
+		return GetLastError();
+	}
+
+	_ftprintf( stderr, TEXT("Resumed %u of %u hosts from the journal.\n"), nResumed, g_nFleetHosts );
+
+	return ERROR_SUCCESS;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: OpenFleetJournal
+//
+//  Desc: Opens the journal for a fleet run. A resumed run replays the
+//        existing journal first. A new run starts an empty journal, but
+//        will not throw away finished hosts unless told to replace them.
+// ----------------------------------------------------------------------------
+LONG OpenFleetJournal( const TCHAR* sJournal, BOOL bResume, BOOL bReplace )
+{
+	LARGE_INTEGER nSize;
+
+	InitializeCrcTable();
+
+	g_hJournal = CreateFile( sJournal,
+							 GENERIC_READ | GENERIC_WRITE,
+							 FILE_SHARE_READ,
+							 NULL,
+							 bReplace ? CREATE_ALWAYS : OPEN_ALWAYS,
+							 FILE_ATTRIBUTE_NORMAL | FILE_FLAG_WRITE_THROUGH,
+							 NULL );
+	if( INVALID_HANDLE_VALUE == g_hJournal )
+	{
+		g_hJournal = NULL;
+		_ftprintf( stderr, TEXT("Unable to open the journal: %s\n"), sJournal );
+		return GetLastError();
+	}
+
+	if( !bResume && !bReplace && (!GetFileSizeEx( g_hJournal, &nSize ) || (nSize.QuadPart > 0)) )
+	{
+		CloseHandle( g_hJournal );
+		g_hJournal = NULL;
+		_ftprintf( stderr, TEXT("The journal %s already holds finished hosts. Resume it with /r or replace it with /c.\n"), sJournal );
+		return ERROR_FILE_EXISTS;
+	}
+
+	InitializeCriticalSection( &g_csJournal );
+
+	if( bResume ) return LoadFleetJournal();
+
+	return ERROR_SUCCESS;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: TakeFleetHost
+//
+//  Desc: Returns the next host for a worker. Shards are dealt round robin,
+//        so shard n holds pending hosts n, n + workers, n + 2 * workers and
+//        so on, and each is handed out in that order. A worker takes from
+//        its own shard until it is empty or another shard has fallen more
+//        than a round behind, and then steals from the shard furthest
+//        behind. A worker stuck on slow hosts so cannot hold back the
+//        reports of the others for long. Returns -1 when nothing is left.
+// ----------------------------------------------------------------------------
+LONG TakeFleetHost( DWORD nWorker )
+{
+	PFLEET_SHARD pShard = &g_pFleetShards[nWorker];
+	DWORD nVictim = nWorker;
+	LONG nHost = -1;
+
+	EnterCriticalSection( &g_csFleet );
+
+	for( DWORD i = 0; i < g_nFleetWorkers; i++ )
+	{
+		if( g_pFleetShards[i].Begin >= g_pFleetShards[i].End ) continue;
+
+		if( (g_pFleetShards[nVictim].Begin >= g_pFleetShards[nVictim].End) ||
+			(g_pFleetShards[i].Begin < g_pFleetShards[nVictim].Begin) ) nVictim = i;
+	}
+
+	if( (pShard->Begin < pShard->End) && (pShard->Begin <= g_pFleetShards[nVictim].Begin + 1) )
+	{
+		nVictim = nWorker;
+	}
+
+	pShard = &g_pFleetShards[nVictim];
+
+	if( pShard->Begin < pShard->End )
+	{
+		nHost = g_pFleetPending[pShard->Begin++ * g_nFleetWorkers + nVictim];
+	}
+
+	LeaveCriticalSection( &g_csFleet );
+
+	return nHost;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: WriteFleetReports
+//
+//  Desc: Writes out every finished report that no earlier host is still
+//        holding back, in host list order, and frees each buffer once it is
+//        written. Only a few reports are ever held in memory at a time. The
+//        final call also reports the hosts that never finished. Called with
+//        g_csFleetOutput held.
+// ----------------------------------------------------------------------------
+void WriteFleetReports( BOOL bFinal )
+{
+	CHAR sMessage[COMPUTER_NAME_LENGTH * 2 + 64];
+	PFLEET_HOST pHost;
+	LONG nResult;
+	DWORD nBytes;
+
+	for( ; g_nFleetWritten < g_nFleetHosts; g_nFleetWritten++ )
+	{
+		pHost = &g_pFleetHosts[g_nFleetWritten];
+
+		if( !pHost->Done && !bFinal ) break;
+
+		nResult = pHost->Done ? pHost->Result : ERROR_BROKEN_PIPE;
+
+		if( ERROR_SUCCESS == nResult )
+		{
+			WriteFile( g_hFleetOutput, pHost->Output, pHost->OutputSize, &nBytes, NULL );
+		}
+		else if( OUTPUT_TEXT != g_nOutputFormat )
+		{
+			// Failures would corrupt structured output, so they go to stderr.
+			_ftprintf( stderr,
+					   TEXT("Failed to collect software from %s (error %ld)\n"),
+					   pHost->ComputerName,
+					   nResult );
+		}
+		else
+		{
+			StringCchPrintfA( sMessage,
+							  sizeof(sMessage),
+							  "Computer name: %S\r\nFailed to collect software (error %ld)\r\n\r\n",
+							  pHost->ComputerName,
+							  nResult );
+
+			WriteFile( g_hFleetOutput, sMessage, lstrlenA( sMessage ), &nBytes, NULL );
+		}
+
+		if( ERROR_SUCCESS != nResult ) g_nFleetFailed++;
+
+		if( pHost->Output ) HeapFree( g_hProcessHeap, NULL, pHost->Output );
+
+		pHost->Output = NULL;
+		pHost->OutputSize = 0;
+		pHost->OutputCapacity = 0;
+	}
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: FinishFleetHost
+//
+//  Desc: Records a host as done and writes out whatever reports it was
+//        holding back. A good report is journaled before it is written, so
+//        anything written is also in the journal.
+// ----------------------------------------------------------------------------
+void FinishFleetHost( PFLEET_HOST pHost )
+{
+	if( g_hJournal && (ERROR_SUCCESS == pHost->Result) ) AppendJournalRecord( pHost );
+
+	EnterCriticalSection( &g_csFleetOutput );
+
+	pHost->Done = TRUE;
+	WriteFleetReports( FALSE );
+
+	LeaveCriticalSection( &g_csFleetOutput );
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: FleetWorkerThread
+//
+//  Desc: Feeds hosts to one worker process and collects its reports. If
+//        the worker dies, the thread stops and the worker's remaining
+//        shard is left for the other workers to steal.
+// ----------------------------------------------------------------------------
+DWORD WINAPI FleetWorkerThread( LPVOID pParameter )
+{
+	PFLEET_WORKER pWorker = (PFLEET_WORKER)pParameter;
+	PFLEET_HOST pHost;
+	CHAR sLine[COMPUTER_NAME_LENGTH * 2 + 2];
+	BYTE pBuffer[FLEET_READ_SIZE];
+	DWORD nLineLength;
+	DWORD nBytes;
+	LONG nHost;
+	LONG nTerminator;
+	BOOL bAlive = TRUE;
+
+	while( bAlive && ((nHost = TakeFleetHost( pWorker->Index )) >= 0) )
+	{
+		pHost = &g_pFleetHosts[nHost];
+
+		// Hand the worker one host name per line.
+		nLineLength = WideCharToMultiByte( CP_ACP,
+										   0,
+										   pHost->ComputerName,
+										   -1,
+										   sLine,
+										   sizeof(sLine) - 1,
+										   NULL,
+										   NULL );
+		if( 0 == nLineLength )
+		{
+			pHost->Result = ERROR_INVALID_PARAMETER;
+			FinishFleetHost( pHost );
+			continue;
+		}
+
+		sLine[nLineLength - 1] = '\n';
+
+		if( !WriteFile( pWorker->hInput, sLine, nLineLength, &nBytes, NULL ) )
+		{
+			pHost->Result = GetLastError();
+			FinishFleetHost( pHost );
+			break;
+		}
+
+		// Read until the worker writes the end-of-host marker.
+		for( ;; )
+		{
+			if( !ReadFile( pWorker->hOutput, pBuffer, sizeof(pBuffer), &nBytes, NULL ) || (0 == nBytes) )
+			{
+				pHost->Result = ERROR_BROKEN_PIPE;
+				bAlive = FALSE;
+				break;
+			}
+
+			if( !AppendFleetOutput( pHost, pBuffer, nBytes ) )
+			{
+				pHost->Result = ERROR_OUTOFMEMORY;
+				bAlive = FALSE;
+				break;
+			}
+
+			nTerminator = FindFleetTerminator( pHost, &pHost->Result );
+			if( nTerminator >= 0 )
+			{
+				pHost->OutputSize = nTerminator;
+				break;
+			}
+		}
+
+		if( !bAlive ) pHost->OutputSize = 0;
+
+		FinishFleetHost( pHost );
+	}
+
+	// Closing the worker's input tells it to exit.
+	CloseHandle( pWorker->hInput );
+	pWorker->hInput = NULL;
+
+	return 0;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: StartFleetWorker
+//
+//  Desc: Starts a copy of this program in worker mode with its standard
+//        input and output redirected to pipes. Fails rather than start a
+//        worker whose options did not fit on its command line.
+// ----------------------------------------------------------------------------
+BOOL StartFleetWorker( PFLEET_WORKER pWorker )
+{
+	TCHAR sModule[MAX_PATH];
+	TCHAR sCommandLine[WORKER_COMMAND_LENGTH];
+	TCHAR sOption[WORKER_COMMAND_LENGTH];
+	HANDLE hChildInput = NULL;
+	HANDLE hChildOutput = NULL;
+	SECURITY_ATTRIBUTES sa;
+	STARTUPINFO si;
+	PROCESS_INFORMATION pi;
+	HRESULT hr;
+	BOOL bResult = FALSE;
+
+	sa.nLength = sizeof(sa);
+	sa.lpSecurityDescriptor = NULL;
+	sa.bInheritHandle = TRUE;
+
+	if( !GetModuleFileName( NULL, sModule, MAX_PATH ) ) return FALSE;
+
+	hr = StringCchPrintf( sCommandLine,
+						  WORKER_COMMAND_LENGTH,
+						  TEXT("\"%s\" /w /o %s"),
+						  sModule,
+						  g_sOutputFormats[g_nOutputFormat] );
+
+	// Filtering and ordering happen in the workers.
+	if( SUCCEEDED( hr ) && g_bSortByVersion ) hr = StringCchCat( sCommandLine, WORKER_COMMAND_LENGTH, TEXT(" /s") );
+
+	if( SUCCEEDED( hr ) && g_sOlderThan )
+	{
+		hr = StringCchPrintf( sOption, WORKER_COMMAND_LENGTH, TEXT(" /v \"%s\""), g_sOlderThan );
+		if( SUCCEEDED( hr ) ) hr = StringCchCat( sCommandLine, WORKER_COMMAND_LENGTH, sOption );
+	}
+
+	if( SUCCEEDED( hr ) && g_bFakeRegistry )
+	{
+		hr = StringCchPrintf( sOption, WORKER_COMMAND_LENGTH, TEXT(" /x %u"), g_nFakeLatency );
+		if( SUCCEEDED( hr ) ) hr = StringCchCat( sCommandLine, WORKER_COMMAND_LENGTH, sOption );
+	}
+
+	// A truncated command line would run the worker with other options.
+	if( FAILED( hr ) )
+	{
+		_ftprintf( stderr, TEXT("The worker command line is too long.\n") );
+		return FALSE;
+	}
+
+	// Only the child's ends of the pipes may be inherited.
+	if( !CreatePipe( &hChildInput, &pWorker->hInput, &sa, 0 ) ) goto done;
+	if( !CreatePipe( &pWorker->hOutput, &hChildOutput, &sa, 0 ) ) goto done;
+
+	SetHandleInformation( pWorker->hInput, HANDLE_FLAG_INHERIT, 0 );
+	SetHandleInformation( pWorker->hOutput, HANDLE_FLAG_INHERIT, 0 );
+
+	ZeroMemory( &si, sizeof(si) );
+	si.cb = sizeof(si);
+	si.dwFlags = STARTF_USESTDHANDLES;
+	si.hStdInput = hChildInput;
+	si.hStdOutput = hChildOutput;
+	si.hStdError = GetStdHandle( STD_ERROR_HANDLE );
+
+	if( !CreateProcess( NULL,
+						sCommandLine,
+						NULL,
+						NULL,
+						TRUE,
+						CREATE_NO_WINDOW,
+						NULL,
+						NULL,
+						&si,
+						&pi ) ) goto done;
+
+	CloseHandle( pi.hThread );
+	pWorker->hProcess = pi.hProcess;
+
+	bResult = TRUE;
+
+done:
+	if( hChildInput ) CloseHandle( hChildInput );
+	if( hChildOutput ) CloseHandle( hChildOutput );
+
+	return bResult;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: LoadFleetHosts
+//
+//  Desc: Reads the host list, one computer name per line. Blank lines are
+//        skipped.
+// ----------------------------------------------------------------------------
+LONG LoadFleetHosts( const TCHAR* sHostFile )
+{
+	TCHAR sLine[COMPUTER_NAME_LENGTH + 2];
+	PFLEET_HOST pNew;
+	FILE* hHostFile = NULL;
+	DWORD nCapacity = 0;
+	size_t nLength;
+	TCHAR* sStart;
+
+	_tfopen_s( &hHostFile, sHostFile, TEXT("r") );
+	if( !hHostFile )
+	{
+		_ftprintf( stderr, TEXT("Unable to open host list: %s\n"), sHostFile );
+		return ERROR_FILE_NOT_FOUND;
+	}
+
+	while( _fgetts( sLine, COMPUTER_NAME_LENGTH + 2, hHostFile ) )
+	{
+		// Trim surrounding white space.
+		sStart = sLine;
+		while( _istspace( *sStart ) ) sStart++;
+
+		nLength = _tcslen( sStart );
+		while( (nLength > 0) && _istspace( sStart[nLength - 1] ) ) sStart[--nLength] = TEXT('\0');
+
+		if( 0 == nLength ) continue;
+
+		if( g_nFleetHosts == nCapacity )
+		{
+			nCapacity = nCapacity ? nCapacity * 2 : 64;
+
+			if( g_pFleetHosts )
+			{
+				pNew = (PFLEET_HOST)HeapReAlloc( g_hProcessHeap,
+												 HEAP_ZERO_MEMORY,
+												 g_pFleetHosts,
+												 sizeof(FLEET_HOST) * nCapacity );
+			}
+			else
+			{
+				pNew = (PFLEET_HOST)HeapAlloc( g_hProcessHeap,
+											   HEAP_ZERO_MEMORY,
+											   sizeof(FLEET_HOST) * nCapacity );
+			}
+
+			if( NULL == pNew )
+			{
+				_ftprintf( stderr, TEXT("Out of memory.\n") );
+				fclose( hHostFile );
+				return ERROR_OUTOFMEMORY;
+			}
+
+			g_pFleetHosts = pNew;
+		}
+
+		StringCchCopy( g_pFleetHosts[g_nFleetHosts].ComputerName, COMPUTER_NAME_LENGTH, sStart );
+		g_nFleetHosts++;
+	}
+
+	fclose( hHostFile );
+
+	return ERROR_SUCCESS;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: RunFleetWorker
+//
+//  Desc: Worker mode. Reads computer names from standard input and writes
+//        each report to standard output followed by the end-of-host marker.
+// ----------------------------------------------------------------------------
+int RunFleetWorker()
+{
+	TCHAR sComputerName[COMPUTER_NAME_LENGTH + 2];
+	size_t nLength;
+	LONG result;
+
+	while( _fgetts( sComputerName, COMPUTER_NAME_LENGTH + 2, stdin ) )
+	{
+		nLength = _tcslen( sComputerName );
+		while( (nLength > 0) && _istspace( sComputerName[nLength - 1] ) ) sComputerName[--nLength] = TEXT('\0');
+
+		result = CollectSoftwareLists( sComputerName, TRUE );
+		if( ERROR_SUCCESS == result )
+		{
+			DisplaySoftwareReport( stdout, sComputerName );
+
+			if( OUTPUT_TEXT == g_nOutputFormat ) _ftprintf( stdout, TEXT("\n") );
+		}
+
+		DestroySoftwareLists();
+
+		// Narrow output, so the marker is the same whatever mode stdout is in.
+		fprintf( stdout, "%c%d\n", FLEET_TERMINATOR, (int)result );
+		fflush( stdout );
+	}
+
+	return 0;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: WaitForThreads
+//
+//  Desc: Waits for every thread in the array to finish. A single wait can
+//        only cover MAXIMUM_WAIT_OBJECTS handles, so larger arrays are
+//        waited on in batches.
+// ----------------------------------------------------------------------------
+void WaitForThreads( const HANDLE* hThreads, DWORD nThreads )
+{
+	for( DWORD i = 0; i < nThreads; i += MAXIMUM_WAIT_OBJECTS )
+	{
+		WaitForMultipleObjects( min( nThreads - i, (DWORD)MAXIMUM_WAIT_OBJECTS ),
+								hThreads + i,
+								TRUE,
+								INFINITE );
+	}
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: RunFleetCoordinator
+//
+//  Desc: Coordinator mode. Splits the host list into one shard per worker
+//        process, lets idle workers steal from slow shards, and streams the
+//        reports to standard output in host list order as they complete.
+//        With a journal, each finished host is recorded as it completes and
+//        a resumed run only hands out the hosts the journal does not hold.
+//        An existing journal is only started over when bReplace is set.
+//        There is no limit on the number of workers; WaitForThreads waits
+//        on their threads in batches.
+// ----------------------------------------------------------------------------
+int RunFleetCoordinator( const TCHAR* sHostFile, DWORD nWorkers, const TCHAR* sJournal, BOOL bResume, BOOL bReplace )
+{
+	PFLEET_WORKER pWorkers = NULL;
+	HANDLE* hThreads = NULL;
+	DWORD nStarted = 0;
+	DWORD nBytes;
+	LONG result = ERROR_SUCCESS;
+	SYSTEM_INFO tSystemInfo;
+
+	result = LoadFleetHosts( sHostFile );
+	if( ERROR_SUCCESS != result ) goto done;
+	if( 0 == g_nFleetHosts ) goto done;
+
+	if( sJournal )
+	{
+		result = OpenFleetJournal( sJournal, bResume, bReplace );
+		if( ERROR_SUCCESS != result ) goto done;
+	}
+
+	// Only hosts without a journaled report are handed out.
+	g_pFleetPending = (LONG*)HeapAlloc( g_hProcessHeap, 0, sizeof(LONG) * g_nFleetHosts );
+	if( NULL == g_pFleetPending )
+	{
+		_ftprintf( stderr, TEXT("Out of memory.\n") );
+		result = ERROR_OUTOFMEMORY;
+		goto done;
+	}
+
+	for( DWORD i = 0; i < g_nFleetHosts; i++ )
+	{
+		if( !g_pFleetHosts[i].Done ) g_pFleetPending[g_nFleetPending++] = (LONG)i;
+	}
+
+	if( 0 == nWorkers )
+	{
+		GetSystemInfo( &tSystemInfo );
+		nWorkers = tSystemInfo.dwNumberOfProcessors;
+	}
+
+	nWorkers = min( nWorkers, g_nFleetPending );
+
+	pWorkers = (PFLEET_WORKER)HeapAlloc( g_hProcessHeap,
+										 HEAP_ZERO_MEMORY,
+										 sizeof(FLEET_WORKER) * nWorkers );
+	hThreads = (HANDLE*)HeapAlloc( g_hProcessHeap,
+								   HEAP_ZERO_MEMORY,
+								   sizeof(HANDLE) * nWorkers );
+	g_pFleetShards = (PFLEET_SHARD)HeapAlloc( g_hProcessHeap,
+											  HEAP_ZERO_MEMORY,
+											  sizeof(FLEET_SHARD) * nWorkers );
+	if( (NULL == pWorkers) || (NULL == hThreads) || (NULL == g_pFleetShards) )
+	{
+		_ftprintf( stderr, TEXT("Out of memory.\n") );
+		result = ERROR_OUTOFMEMORY;
+		goto done;
+	}
+
+	// Deal the pending hosts out round robin. The hosts in flight then stay
+	// close together in list order, so few finished reports wait in memory
+	// behind one that is still running.
+	for( DWORD i = 0; i < nWorkers; i++ )
+	{
+		g_pFleetShards[i].Begin = 0;
+		g_pFleetShards[i].End = (LONG)((g_nFleetPending - i + nWorkers - 1) / nWorkers);
+	}
+
+	g_nFleetWorkers = nWorkers;
+	InitializeCriticalSection( &g_csFleet );
+	InitializeCriticalSection( &g_csFleetOutput );
+
+	g_hFleetOutput = GetStdHandle( STD_OUTPUT_HANDLE );
+
+	if( OUTPUT_CSV == g_nOutputFormat )
+	{
+		WriteFile( g_hFleetOutput, CSV_HEADER, sizeof(CSV_HEADER) - 1, &nBytes, NULL );
+	}
+
+	// Reports resumed from the journal that lead the list go out first.
+	EnterCriticalSection( &g_csFleetOutput );
+	WriteFleetReports( FALSE );
+	LeaveCriticalSection( &g_csFleetOutput );
+
+	for( DWORD i = 0; i < nWorkers; i++ )
+	{
+		pWorkers[i].Index = i;
+
+		if( !StartFleetWorker( &pWorkers[i] ) )
+		{
+			_ftprintf( stderr, TEXT("Failed to start worker process %u.\n"), i );
+
+			// Its shard is simply stolen by the workers that did start.
+			continue;
+		}
+
+		hThreads[nStarted] = CreateThread( NULL, 0, FleetWorkerThread, &pWorkers[i], 0, NULL );
+		if( NULL == hThreads[nStarted] )
+		{
+			_ftprintf( stderr, TEXT("Failed to start worker thread %u.\n"), i );
+			CloseHandle( pWorkers[i].hInput );
+			pWorkers[i].hInput = NULL;
+			continue;
+		}
+
+		nStarted++;
+	}
+
+	WaitForThreads( hThreads, nStarted );
+
+	for( DWORD i = 0; i < nStarted; i++ ) CloseHandle( hThreads[i] );
+
+	// Whatever is left never finished, because every worker died.
+	EnterCriticalSection( &g_csFleetOutput );
+	WriteFleetReports( TRUE );
+	LeaveCriticalSection( &g_csFleetOutput );
+
+	if( g_nFleetFailed ) result = -1;
+
+	DeleteCriticalSection( &g_csFleetOutput );
+	DeleteCriticalSection( &g_csFleet );
+
+done:
+	if( pWorkers )
+	{
+		for( DWORD i = 0; i < nWorkers; i++ )
+		{
+			if( pWorkers[i].hInput ) CloseHandle( pWorkers[i].hInput );
+			if( pWorkers[i].hOutput ) CloseHandle( pWorkers[i].hOutput );
+
+			if( pWorkers[i].hProcess )
+			{
+				WaitForSingleObject( pWorkers[i].hProcess, INFINITE );
+				CloseHandle( pWorkers[i].hProcess );
+			}
+		}
+
+		HeapFree( g_hProcessHeap, NULL, pWorkers );
+	}
+
+	if( hThreads ) HeapFree( g_hProcessHeap, NULL, hThreads );
+
+	if( g_pFleetHosts )
+	{
+		for( DWORD i = 0; i < g_nFleetHosts; i++ )
+		{
+			if( g_pFleetHosts[i].Output ) HeapFree( g_hProcessHeap, NULL, g_pFleetHosts[i].Output );
+		}
+
+		HeapFree( g_hProcessHeap, NULL, g_pFleetHosts );
+	}
+
+	if( g_pFleetShards ) HeapFree( g_hProcessHeap, NULL, g_pFleetShards );
+	if( g_pFleetPending ) HeapFree( g_hProcessHeap, NULL, g_pFleetPending );
+
+	if( g_hJournal )
+	{
+		CloseHandle( g_hJournal );
+		DeleteCriticalSection( &g_csJournal );
+	}
+
+	return result;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: ParseReportName
+//
+//  Desc: Recovers the computer name and timestamp from a report file name
+//        of the form COMPUTER_MMddyyyy-HHmmss.txt. The timestamp is written
+//        as yyyy-MM-dd HH:mm:ss.
+// ----------------------------------------------------------------------------
+BOOL ParseReportName( const TCHAR* sName, TCHAR* sComputerName, char* sTimestamp )
+{
+	const TCHAR* sSeparator = _tcsrchr( sName, TEXT('_') );
+	const TCHAR* d;
+
+	if( NULL == sSeparator ) return FALSE;
+
+	// MMddyyyy-HHmmss.txt
+	d = sSeparator + 1;
+
+	if( _tcslen( d ) != 19 ) return FALSE;
+	if( (TEXT('-') != d[8]) || (CompareString( LOCALE_USER_DEFAULT, NORM_IGNORECASE, d + 15, 4, TEXT(".txt"), 4 ) != CSTR_EQUAL) ) return FALSE;
+
+	for( int i = 0; i < 15; i++ )
+	{
+		if( (8 != i) && ((d[i] < TEXT('0')) || (d[i] > TEXT('9'))) ) return FALSE;
+	}
+
+	if( (sSeparator == sName) ||
+		FAILED( StringCchCopyN( sComputerName, COMPUTER_NAME_LENGTH, sName, sSeparator - sName ) ) ) return FALSE;
+	StringCchPrintfA( sTimestamp,
+					  IMPORT_TIMESTAMP_LENGTH,
+					  "%c%c%c%c-%c%c-%c%c %c%c:%c%c:%c%c",
+					  (char)d[4], (char)d[5], (char)d[6], (char)d[7],
+					  (char)d[0], (char)d[1],
+					  (char)d[2], (char)d[3],
+					  (char)d[9], (char)d[10],
+					  (char)d[11], (char)d[12],
+					  (char)d[13], (char)d[14] );
+
+	return TRUE;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: IsReportHeader
+//
+//  Desc: Returns TRUE for the lines of a text report that are not software
+//        rows: the report header, blank lines and fleet failure notes.
+// ----------------------------------------------------------------------------
+BOOL IsReportHeader( const char* pLine, DWORD nLine )
+{
+	static const char* const sPrefixes[] =
+	{
+		"Computer name: ",
+		"Install Date ",
+		"Failed to collect software "
+	};
+	DWORD nPrefix;
+	DWORD i;
+
+	for( i = 0; (i < nLine) && ('-' == pLine[i]); i++ );
+	if( i == nLine ) return TRUE;
+
+	for( i = 0; i < sizeof(sPrefixes) / sizeof(sPrefixes[0]); i++ )
+	{
+		nPrefix = lstrlenA( sPrefixes[i] );
+
+		if( (nLine >= nPrefix) && (memcmp( pLine, sPrefixes[i], nPrefix ) == 0) ) return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: WriteImportField
+//
+//  Desc: Converts a field of a report from the ANSI code page it was
+//        written in and appends it to the output as quoted UTF-8 CSV.
+// ----------------------------------------------------------------------------
+void WriteImportField( POUTPUT_BUFFER pOutput, WCHAR* sField, const char* pField, DWORD nLength )
+{
+	int nUnits = 0;
+
+	if( nLength ) nUnits = MultiByteToWideChar( CP_ACP, 0, pField, nLength, sField, IMPORT_LINE_LENGTH );
+
+	WriteOutputStringN( pOutput, sField, nUnits, OUTPUT_CSV );
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: ImportReport
+//
+//  Desc: Parses one mapped report in place and appends a CSV row for each
+//        software line. Rows are the "%-20s%s -- %s" lines written by
+//        DisplaySoftwareList, so the name starts at column 20 unless the
+//        install date overflowed it. Other lines that are not part of the
+//        report header are counted as skipped. Returns the number of rows
+//        found.
+// ----------------------------------------------------------------------------
+LONG ImportReport( POUTPUT_BUFFER pOutput,
+				   WCHAR* sField,
+				   const TCHAR* sComputerName,
+				   const char* sTimestamp,
+				   const char* pData,
+				   DWORD nSize,
+				   LONG* pSkippedRows )
+{
+	const char* pEnd = pData + nSize;
+	const char* pLine = pData;
+	const char* pLineEnd;
+	const char* pNext;
+	const char* pDateEnd;
+	const char* pName;
+	const char* pSplit;
+	DWORD nComputerName = lstrlenW( sComputerName );
+	DWORD nTimestamp = lstrlenA( sTimestamp );
+	DWORD nLine;
+	LONG nRows = 0;
+
+	for( ; pLine < pEnd; pLine = pNext )
+	{
+		pLineEnd = (const char*)memchr( pLine, '\n', pEnd - pLine );
+		if( NULL == pLineEnd ) pLineEnd = pEnd;
+
+		pNext = pLineEnd + 1;
+
+		if( (pLineEnd > pLine) && ('\r' == pLineEnd[-1]) ) pLineEnd--;
+
+		nLine = (DWORD)(pLineEnd - pLine);
+
+		if( IsReportHeader( pLine, nLine ) ) continue;
+
+		// Lines too long to convert in one piece are not rows we wrote.
+		if( nLine > IMPORT_LINE_LENGTH )
+		{
+			(*pSkippedRows)++;
+			continue;
+		}
+
+		if( (nLine >= IMPORT_DATE_WIDTH) && (' ' == pLine[IMPORT_DATE_WIDTH - 1]) )
+		{
+			// The date is padded to its column; an empty date is all padding.
+			pName = pLine + IMPORT_DATE_WIDTH;
+			pDateEnd = pName;
+			while( (pDateEnd > pLine) && (' ' == pDateEnd[-1]) ) pDateEnd--;
+		}
+		else
+		{
+			// The date overflowed its column, so it ends at the first space.
+			pDateEnd = pLine;
+			while( (pDateEnd < pLineEnd) && (' ' != *pDateEnd) ) pDateEnd++;
+
+			pName = pDateEnd;
+			while( (pName < pLineEnd) && (' ' == *pName) ) pName++;
+		}
+
+		// The name and version are split at the last " -- ".
+		pSplit = NULL;
+
+		for( const char* p = pLineEnd - 4; p >= pName; p-- )
+		{
+			if( (' ' == p[0]) && ('-' == p[1]) && ('-' == p[2]) && (' ' == p[3]) )
+			{
+				pSplit = p;
+				break;
+			}
+		}
+
+		if( NULL == pSplit )
+		{
+			(*pSkippedRows)++;
+			continue;
+		}
+
+		// Make room for the whole row up front, at the most bytes a unit
+		// can take once encoded, so a flush never splits a row between
+		// threads.
+		ReserveOutputBuffer( pOutput, (nLine + nComputerName) * 6 + nTimestamp + 16 + OUTPUT_CHUNK_SIZE );
+
+		WriteOutputText( pOutput, "\"" );
+		WriteOutputStringN( pOutput, sComputerName, nComputerName, OUTPUT_CSV );
+		WriteOutputText( pOutput, "\",\"" );
+		WriteOutputText( pOutput, sTimestamp );
+		WriteOutputText( pOutput, "\",\"" );
+		WriteImportField( pOutput, sField, pLine, (DWORD)(pDateEnd - pLine) );
+		WriteOutputText( pOutput, "\",\"" );
+		WriteImportField( pOutput, sField, pName, (DWORD)(pSplit - pName) );
+		WriteOutputText( pOutput, "\",\"" );
+		WriteImportField( pOutput, sField, pSplit + 4, (DWORD)(pLineEnd - pSplit - 4) );
+		WriteOutputText( pOutput, "\"\r\n" );
+
+		nRows++;
+	}
+
+	return nRows;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: ImportThread
+//
+//  Desc: Takes report files off the shared index, maps each one and parses
+//        it into the thread's output buffer.
+// ----------------------------------------------------------------------------
+DWORD WINAPI ImportThread( LPVOID pParameter )
+{
+	PIMPORT_JOB pJob = (PIMPORT_JOB)pParameter;
+	OUTPUT_BUFFER tOutput;
+	WCHAR* sField = NULL;
+	TCHAR sFilename[MAX_PATH];
+	TCHAR sComputerName[COMPUTER_NAME_LENGTH];
+	char sTimestamp[IMPORT_TIMESTAMP_LENGTH];
+	LONG nSkippedRows = 0;
+	const TCHAR* sName;
+	HANDLE hFile;
+	HANDLE hMapping;
+	LPVOID pView;
+	LARGE_INTEGER nFileSize;
+	LONG nFile;
+
+	ZeroMemory( &tOutput, sizeof(tOutput) );
+	tOutput.hOutput = pJob->hOutput;
+	tOutput.pLock = &pJob->csOutput;
+	tOutput.Capacity = IMPORT_BUFFER_SIZE;
+	tOutput.Data = (PBYTE)HeapAlloc( g_hProcessHeap, 0, IMPORT_BUFFER_SIZE );
+	sField = (WCHAR*)HeapAlloc( g_hProcessHeap, 0, IMPORT_LINE_LENGTH * sizeof(WCHAR) );
+	if( (NULL == tOutput.Data) || (NULL == sField) )
+	{
+		_ftprintf( stderr, TEXT("Out of memory.\n") );
+		if( tOutput.Data ) HeapFree( g_hProcessHeap, NULL, tOutput.Data );
+		if( sField ) HeapFree( g_hProcessHeap, NULL, sField );
+		return ERROR_OUTOFMEMORY;
+	}
+
+	while( (nFile = InterlockedIncrement( &pJob->NextFile ) - 1) < (LONG)pJob->FileCount )
+	{
+		sName = pJob->NamePool + pJob->NameOffsets[nFile];
+
+		if( !ParseReportName( sName, sComputerName, sTimestamp ) )
+		{
+			InterlockedIncrement( &pJob->Skipped );
+			continue;
+		}
+
+		StringCchCopy( sFilename, MAX_PATH, pJob->Directory );
+		StringCchCat( sFilename, MAX_PATH, TEXT("\\") );
+		StringCchCat( sFilename, MAX_PATH, sName );
+
+		hFile = CreateFile( sFilename,
+							GENERIC_READ,
+							FILE_SHARE_READ,
+							NULL,
+							OPEN_EXISTING,
+							FILE_FLAG_SEQUENTIAL_SCAN,
+							NULL );
+		if( INVALID_HANDLE_VALUE == hFile )
+		{
+			_ftprintf( stderr, TEXT("Unable to open report: %s\n"), sFilename );
+			InterlockedIncrement( &pJob->Skipped );
+			continue;
+		}
+
+		// Empty files cannot be mapped and have nothing to import anyway.
+		if( !GetFileSizeEx( hFile, &nFileSize ) || (0 == nFileSize.QuadPart) || (0 != nFileSize.HighPart) )
+		{
+			CloseHandle( hFile );
+			InterlockedIncrement( &pJob->Skipped );
+			continue;
+		}
+
+		hMapping = CreateFileMapping( hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+		pView = hMapping ? MapViewOfFile( hMapping, FILE_MAP_READ, 0, 0, 0 ) : NULL;
+
+		if( pView )
+		{
+			InterlockedExchangeAdd( &pJob->Rows,
+									ImportReport( &tOutput,
+												  sField,
+												  sComputerName,
+												  sTimestamp,
+												  (const char*)pView,
+												  nFileSize.LowPart,
+												  &nSkippedRows ) );
+			InterlockedIncrement( &pJob->Imported );
+
+			UnmapViewOfFile( pView );
 		}
 		else
 		{
-			StringCchCopy( sComputerName, nComputerNameSize, argv[1] );
-			bRemoteComputer = TRUE;
+			_ftprintf( stderr, TEXT("Unable to map report: %s\n"), sFilename );
+			InterlockedIncrement( &pJob->Skipped );
 		}
-	}
-	else
-	{
-		// Get the computer name.
-		GetComputerName( sComputerName, &nComputerNameSize );
+
+		if( hMapping ) CloseHandle( hMapping );
+		CloseHandle( hFile );
 	}
 
-	if( bRemoteComputer )
+	FlushOutputBuffer( &tOutput );
+	HeapFree( g_hProcessHeap, NULL, tOutput.Data );
+	HeapFree( g_hProcessHeap, NULL, sField );
+
+	InterlockedExchangeAdd( &pJob->SkippedRows, nSkippedRows );
+
+	return 0;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: ListReports
+//
+//  Desc: Collects the names of the .txt files in the report directory into
+//        a single name pool so millions of files do not mean millions of
+//        allocations.
+// ----------------------------------------------------------------------------
+LONG ListReports( PIMPORT_JOB pJob )
+{
+	TCHAR sPattern[MAX_PATH];
+	WIN32_FIND_DATA tFindData;
+	HANDLE hFind;
+	DWORD nPoolSize = 0;
+	DWORD nPoolCapacity = 0;
+	DWORD nOffsetCapacity = 0;
+	DWORD nLength;
+	LPVOID pNew;
+	LONG result = ERROR_SUCCESS;
+
+	StringCchCopy( sPattern, MAX_PATH, pJob->Directory );
+	StringCchCat( sPattern, MAX_PATH, TEXT("\\*.txt") );
+
+	hFind = FindFirstFile( sPattern, &tFindData );
+	if( INVALID_HANDLE_VALUE == hFind ) return ERROR_SUCCESS;
+
+	do
 	{
-		// Connect to the registry on the remote computer.
-		result = RegConnectRegistry( sComputerName,
-									 HKEY_LOCAL_MACHINE,
-									 &g_hBaseKey );
-		if( ERROR_SUCCESS != result )
+		if( tFindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ) continue;
+
+		nLength = (DWORD)_tcslen( tFindData.cFileName ) + 1;
+
+		if( nPoolSize + nLength > nPoolCapacity )
 		{
-			_ftprintf( stderr,
-					   TEXT("Failed to connect to the remote registry on %s\n"),
-					   sComputerName );
+			nPoolCapacity = nPoolCapacity ? nPoolCapacity * 2 : 65536;
+
+			pNew = pJob->NamePool ?
+				HeapReAlloc( g_hProcessHeap, 0, pJob->NamePool, nPoolCapacity * sizeof(TCHAR) ) :
+				HeapAlloc( g_hProcessHeap, 0, nPoolCapacity * sizeof(TCHAR) );
+			if( NULL == pNew )
+			{
+				result = ERROR_OUTOFMEMORY;
+				break;
+			}
+
+			pJob->NamePool = (TCHAR*)pNew;
+		}
+
+		if( pJob->FileCount == nOffsetCapacity )
+		{
+			nOffsetCapacity = nOffsetCapacity ? nOffsetCapacity * 2 : 4096;
+
+			pNew = pJob->NameOffsets ?
+				HeapReAlloc( g_hProcessHeap, 0, pJob->NameOffsets, nOffsetCapacity * sizeof(DWORD) ) :
+				HeapAlloc( g_hProcessHeap, 0, nOffsetCapacity * sizeof(DWORD) );
+			if( NULL == pNew )
+			{
+				result = ERROR_OUTOFMEMORY;
+				break;
+			}
 
-			return -1;
+			pJob->NameOffsets = (DWORD*)pNew;
 		}
+
+		CopyMemory( pJob->NamePool + nPoolSize, tFindData.cFileName, nLength * sizeof(TCHAR) );
+		pJob->NameOffsets[pJob->FileCount++] = nPoolSize;
+		nPoolSize += nLength;
 	}
+	while( FindNextFile( hFind, &tFindData ) );
 
-	// Open the appropriate registry key to enumerate the list of installed
-	// software.
-	result = RegOpenKeyEx( g_hBaseKey,
-						   TEXT(SOFTWARE_LIST_KEY),
-						   0,
-						   KEY_READ,
-						   &hSoftwareListKey );
-	if( ERROR_SUCCESS != result )
+	FindClose( hFind );
+
+	if( ERROR_SUCCESS != result ) _ftprintf( stderr, TEXT("Out of memory.\n") );
+
+	return result;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: RunImport
+//
+//  Desc: Import mode. Parses every COMPUTER_MMddyyyy-HHmmss.txt report in a
+//        directory on one thread per processor and writes the rows to a CSV
+//        file with the computer name and timestamp recovered from each file
+//        name. Reports are read in the ANSI code page they were written in;
+//        the CSV is UTF-8, the same as /o csv.
+// ----------------------------------------------------------------------------
+int RunImport( const TCHAR* sDirectory, const TCHAR* sOutputFile )
+{
+	static const char sHeader[] = "Computer,Timestamp,InstallDate,DisplayName,DisplayVersion\r\n";
+	HANDLE* hThreads = NULL;
+	IMPORT_JOB tJob;
+	SYSTEM_INFO tSystemInfo;
+	DWORD nThreads;
+	DWORD nStarted = 0;
+	DWORD nBytes;
+	LONG result = ERROR_SUCCESS;
+
+	ZeroMemory( &tJob, sizeof(tJob) );
+	tJob.Directory = sDirectory;
+
+	result = ListReports( &tJob );
+	if( ERROR_SUCCESS != result ) goto done;
+
+	tJob.hOutput = CreateFile( sOutputFile,
+							   GENERIC_WRITE,
+							   0,
+							   NULL,
+							   CREATE_ALWAYS,
+							   FILE_ATTRIBUTE_NORMAL,
+							   NULL );
+	if( INVALID_HANDLE_VALUE == tJob.hOutput )
 	{
-		_ftprintf( stderr, TEXT("Unable to open the required registry key!\n") );
+		_ftprintf( stderr, TEXT("Unable to open output file for writing: %s\n"), sOutputFile );
+		tJob.hOutput = NULL;
+		result = GetLastError();
 		goto done;
 	}
 
-	// Query the information about this key to get the number of subkeys
-	// and the length of the longest-named subkey.
-	result = RegQueryInfoKey( hSoftwareListKey,
-							  NULL,
-							  NULL,
-							  NULL,
-							  &nNumberOfSubkeys,
-							  &nSubkeyNameSize,
-							  NULL,
-							  NULL,
-							  NULL,
-							  NULL,
-							  NULL,
-							  NULL );
-	if( ERROR_SUCCESS != result )
+	WriteFile( tJob.hOutput, sHeader, sizeof(sHeader) - 1, &nBytes, NULL );
+
+	// One thread per processor, however many there are.
+	GetSystemInfo( &tSystemInfo );
+	nThreads = tSystemInfo.dwNumberOfProcessors;
+
+	hThreads = (HANDLE*)HeapAlloc( g_hProcessHeap, 0, sizeof(HANDLE) * nThreads );
+
+	InitializeCriticalSection( &tJob.csOutput );
+
+	for( DWORD i = 0; hThreads && (i < nThreads); i++ )
 	{
-		_ftprintf( stderr, TEXT("Unable to query information about the key, %S\n"), TEXT(SOFTWARE_LIST_KEY) );
-		goto done;
+		hThreads[nStarted] = CreateThread( NULL, 0, ImportThread, &tJob, 0, NULL );
+		if( hThreads[nStarted] ) nStarted++;
+	}
+
+	if( nStarted > 0 )
+	{
+		WaitForThreads( hThreads, nStarted );
 	}
+	else
+	{
+		// Fall back to importing on this thread.
+		ImportThread( &tJob );
+	}
+
+	for( DWORD i = 0; i < nStarted; i++ ) CloseHandle( hThreads[i] );
+
+	DeleteCriticalSection( &tJob.csOutput );
+
+	_ftprintf( stderr,
+			   TEXT("Imported %ld rows from %ld reports (%ld reports and %ld rows skipped).\n"),
+			   tJob.Rows,
+			   tJob.Imported,
+			   tJob.Skipped,
+			   tJob.SkippedRows );
+
+done:
+	if( tJob.hOutput ) CloseHandle( tJob.hOutput );
+	if( hThreads ) HeapFree( g_hProcessHeap, NULL, hThreads );
+	if( tJob.NamePool ) HeapFree( g_hProcessHeap, NULL, tJob.NamePool );
+	if( tJob.NameOffsets ) HeapFree( g_hProcessHeap, NULL, tJob.NameOffsets );
+
+	return result;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: IsSwitch
+//
+//  Desc: Returns TRUE if the argument is the given command line switch.
+// ----------------------------------------------------------------------------
+BOOL IsSwitch( const TCHAR* sArgument, const TCHAR* sSwitch )
+{
+	return CompareString( LOCALE_USER_DEFAULT,
+						  NORM_IGNORECASE,
+						  sArgument,
+						  -1,
+						  sSwitch,
+						  -1 ) == CSTR_EQUAL;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Name: _tmain
+//
+//  Desc: Application entry point.
+// ----------------------------------------------------------------------------
+int _tmain( int argc, TCHAR** argv )
+{
+	TCHAR sComputerName[COMPUTER_NAME_LENGTH];
+	TCHAR sFilename[MAX_PATH];
+	TCHAR sPath[MAX_PATH];
+	TCHAR sTime[50];
+	TCHAR sDate[50];
+	const TCHAR* sHostFile = NULL;
+	const TCHAR* sJournal = NULL;
+	const TCHAR* sImportDirectory = NULL;
+	const TCHAR* sImportFile = NULL;
+	DWORD nComputerNameSize = COMPUTER_NAME_LENGTH;
+	DWORD nWorkers = 0;
+	LONG result = ERROR_SUCCESS;
+	BOOL bRemoteComputer = FALSE;
+	BOOL bPrintToFile = FALSE;
+	BOOL bWorker = FALSE;
+	BOOL bResume = FALSE;
+	BOOL bReplace = FALSE;
+	FILE* hFile = stdout;
+	SYSTEMTIME tDateTime;
 
-	// Get a handle to the process heap and allocate memory for the subkey
-	// name buffer.
+	// Get a handle to the process heap used for the software lists.
 	g_hProcessHeap = GetProcessHeap();
 	if( NULL == g_hProcessHeap )
 	{
 		_ftprintf( stderr, TEXT("Failed to get the process heap handle.\n") );
-		goto done;
+		return -1;
 	}
 
-	sSubkeyName = (TCHAR*)HeapAlloc( g_hProcessHeap,
-									 HEAP_ZERO_MEMORY,
-									 sizeof(TCHAR) * (nSubkeyNameSize + 1) );
-	if( NULL == sSubkeyName )
+	for( int i = 1; i < argc; i++ )
 	{
-		_ftprintf( stderr, TEXT("Out of memory error when creating sSubkeyName.\n") );
-		goto done;
-	}
+		if( IsSwitch( argv[i], TEXT("/?") ) )
+		{
+			_tprintf( TEXT("instsoft version %d.%d, Copyright (c) 2011, Lucas M. Suggs\n"), VERSION_MAJOR, VERSION_MINOR );
+			_tprintf( TEXT("Usage: %s [/o text|csv|json] [/s] [/v version] [/f path] [computername]\n"), argv[0] );
+			_tprintf( TEXT("       %s /m hostfile [/n workers] [/j journal [/r|/c]] [/o text|csv|json] [/s] [/v version] [/x latency]\n"), argv[0] );
+			_tprintf( TEXT("       %s /i reportpath csvfile\n"), argv[0] );
+			_tprintf( TEXT("\n") );
+			_tprintf( TEXT("  /o  Write the list as text, UTF-8 CSV or UTF-8 JSON lines.\n") );
+			_tprintf( TEXT("  /f  Write the report to a file in the given directory.\n") );
+			_tprintf( TEXT("  /s  Sort by version instead of name.\n") );
+			_tprintf( TEXT("  /v  Only list software older than the given version.\n") );
+			_tprintf( TEXT("  /m  Collect from every host listed in the host file.\n") );
+			_tprintf( TEXT("  /n  Number of worker processes for /m, one per processor by default.\n") );
+			_tprintf( TEXT("  /j  Record finished hosts in a journal as the fleet run goes.\n") );
+			_tprintf( TEXT("  /r  Resume from the journal, skipping hosts already finished.\n") );
+			_tprintf( TEXT("  /c  Start the journal over, discarding the hosts it holds.\n") );
+			_tprintf( TEXT("  /x  Use synthetic records after the given latency in milliseconds\n") );
+			_tprintf( TEXT("      instead of reading the registry, for load testing.\n") );
+			_tprintf( TEXT("  /i  Import saved text reports into one UTF-8 CSV file.\n") );
 
-	// Enumerate the list of subkeys and retrieve the software information
-	// from each one.
-	for( DWORD i = 0; i < nNumberOfSubkeys; i++ )
-	{
-		nSubkeyNameSize = MAX_KEY_LENGTH;
+			return 0;
+		}
+		else if( IsSwitch( argv[i], TEXT("/f") ) && (i + 1 < argc) )
+		{
+			bPrintToFile = TRUE;
 
-		result = RegEnumKeyEx( hSoftwareListKey,
-							   i,
-							   sSubkeyName,
-							   &nSubkeyNameSize,
-							   NULL,
-							   NULL,
-							   NULL,
-							   NULL );
-		if( ERROR_SUCCESS == result )
+			StringCchCopy( sPath, MAX_PATH, argv[++i] );
+		}
+		else if( IsSwitch( argv[i], TEXT("/m") ) && (i + 1 < argc) )
 		{
-			QuerySubkey( sSubkeyName, nSubkeyNameSize );
+			sHostFile = argv[++i];
 		}
-	}
+		else if( IsSwitch( argv[i], TEXT("/n") ) && (i + 1 < argc) )
+		{
+			nWorkers = _tcstoul( argv[++i], NULL, 10 );
+		}
+		else if( IsSwitch( argv[i], TEXT("/i") ) && (i + 2 < argc) )
+		{
+			sImportDirectory = argv[++i];
+			sImportFile = argv[++i];
+		}
+		else if( IsSwitch( argv[i], TEXT("/o") ) && (i + 1 < argc) )
+		{
+			i++;
 
-	// Open the appropriate registry key to enumerate the list of installed
-	// software.
-	result = RegOpenKeyEx( g_hBaseKey,
-						   TEXT(SOFTWARE_LIST_KEY2),
-						   0,
-						   KEY_READ,
-						   &hSoftwareListKey );
-	if( ERROR_SUCCESS != result )
-	{
-		_ftprintf( stderr, TEXT("Unable to open the required registry key!\n") );
-		goto done;
+			for( DWORD j = 0; j <= OUTPUT_JSON; j++ )
+			{
+				if( IsSwitch( argv[i], g_sOutputFormats[j] ) ) g_nOutputFormat = (OUTPUT_FORMAT)j;
+			}
+		}
+		else if( IsSwitch( argv[i], TEXT("/s") ) )
+		{
+			g_bSortByVersion = TRUE;
+		}
+		else if( IsSwitch( argv[i], TEXT("/v") ) && (i + 1 < argc) )
+		{
+			g_sOlderThan = argv[++i];
+			ParseVersionKey( g_sOlderThan, &g_tOlderThan );
+		}
+		else if( IsSwitch( argv[i], TEXT("/j") ) && (i + 1 < argc) )
+		{
+			sJournal = argv[++i];
+		}
+		else if( IsSwitch( argv[i], TEXT("/r") ) )
+		{
+			bResume = TRUE;
+		}
+		else if( IsSwitch( argv[i], TEXT("/c") ) )
+		{
+			bReplace = TRUE;
+		}
+		else if( IsSwitch( argv[i], TEXT("/w") ) )
+		{
+			bWorker = TRUE;
+		}
+		else if( IsSwitch( argv[i], TEXT("/x") ) && (i + 1 < argc) )
+		{
+			g_bFakeRegistry = TRUE;
+			g_nFakeLatency = _tcstoul( argv[++i], NULL, 10 );
+		}
+		else
+		{
+			StringCchCopy( sComputerName, nComputerNameSize, argv[i] );
+			bRemoteComputer = TRUE;
+		}
 	}
 
-	// Query the information about this key to get the number of subkeys
-	// and the length of the longest-named subkey.
-	result = RegQueryInfoKey( hSoftwareListKey,
-							  NULL,
-							  NULL,
-							  NULL,
-							  &nNumberOfSubkeys,
-							  &nSubkeyNameSize,
-							  NULL,
-							  NULL,
-							  NULL,
-							  NULL,
-							  NULL,
-							  NULL );
-	if( ERROR_SUCCESS != result )
+	// The encoded formats are written as raw UTF-8 bytes.
+	g_bSse2 = IsProcessorFeaturePresent( PF_XMMI64_INSTRUCTIONS_AVAILABLE );
+
+	if( (OUTPUT_TEXT != g_nOutputFormat) && !bPrintToFile )
 	{
-		_ftprintf( stderr, TEXT("Unable to query information about the key, %S\n"), TEXT(SOFTWARE_LIST_KEY2) );
-		goto done;
+		_setmode( _fileno( stdout ), _O_BINARY );
 	}
 
-	// Get a handle to the process heap and allocate memory for the subkey
-	// name buffer.
-	g_hProcessHeap = GetProcessHeap();
-	if( NULL == g_hProcessHeap )
+	if( bWorker ) return RunFleetWorker();
+	if( (bResume || bReplace) && !sJournal )
 	{
-		_ftprintf( stderr, TEXT("Failed to get the process heap handle.\n") );
-		goto done;
+		_ftprintf( stderr, TEXT("/r and /c need a journal given with /j.\n") );
+		return -1;
 	}
 
-	sSubkeyName = (TCHAR*)HeapAlloc( g_hProcessHeap,
-									 HEAP_ZERO_MEMORY,
-									 sizeof(TCHAR) * (nSubkeyNameSize + 1) );
-	if( NULL == sSubkeyName )
+	if( bResume && bReplace )
 	{
-		_ftprintf( stderr, TEXT("Out of memory error when creating sSubkeyName.\n") );
-		goto done;
+		_ftprintf( stderr, TEXT("/r and /c cannot be used together.\n") );
+		return -1;
 	}
 
-	// Enumerate the list of subkeys and retrieve the software information
-	// from each one.
-	for( DWORD i = 0; i < nNumberOfSubkeys; i++ )
-	{
-		nSubkeyNameSize = MAX_KEY_LENGTH;
+	if( sHostFile ) return RunFleetCoordinator( sHostFile, nWorkers, sJournal, bResume, bReplace );
+	if( sImportDirectory ) return RunImport( sImportDirectory, sImportFile );
 
-		result = RegEnumKeyEx( hSoftwareListKey,
-							   i,
-							   sSubkeyName,
-							   &nSubkeyNameSize,
-							   NULL,
-							   NULL,
-							   NULL,
-							   NULL );
-		if( ERROR_SUCCESS == result )
-		{
-			QuerySubkey2( sSubkeyName, nSubkeyNameSize );
-		}
+	if( !bRemoteComputer )
+	{
+		// Get the computer name.
+		GetComputerName( sComputerName, &nComputerNameSize );
 	}
 
-	MergeLists();
+	result = CollectSoftwareLists( sComputerName, bRemoteComputer );
+	if( ERROR_SUCCESS != result ) goto done;
 
 	// If we are outputting to a file, open it now.
 	if( bPrintToFile )
@@ -789,11 +3436,11 @@ int _tmain( int argc, TCHAR** argv )
 		StringCchCat( sFilename, MAX_PATH, sDate );
 		StringCchCat( sFilename, MAX_PATH, TEXT("-") );
 		StringCchCat( sFilename, MAX_PATH, sTime );
-		StringCchCat( sFilename, MAX_PATH, TEXT(".txt") );
+		StringCchCat( sFilename, MAX_PATH, g_sOutputExtensions[g_nOutputFormat] );
 
 		_tprintf( TEXT("%s\n"), sFilename );
 
-		_tfopen_s( &hFile, sFilename, TEXT("w") );
+		_tfopen_s( &hFile, sFilename, (OUTPUT_TEXT == g_nOutputFormat) ? TEXT("w") : TEXT("wb") );
 		if( !hFile )
 		{
 			_ftprintf( stderr, TEXT("Unable to open output file for writing: %s\n"), sFilename );
@@ -801,12 +3448,9 @@ int _tmain( int argc, TCHAR** argv )
 		}
 	}
 
-	// Display the table header.
-	_ftprintf( hFile, TEXT("Computer name: %s\n"), sComputerName );
-	_ftprintf( hFile, TEXT("------------------------------------\n\n") );
-	_ftprintf( hFile, TEXT("%-20sProgram Name\n\n"), TEXT("Install Date") );
+	if( OUTPUT_CSV == g_nOutputFormat ) fputs( CSV_HEADER, hFile );
 
-	DisplaySoftwareList( hFile );
+	DisplaySoftwareReport( hFile, sComputerName );
 
 	if( bPrintToFile )
 	{
@@ -816,8 +3460,5 @@ int _tmain( int argc, TCHAR** argv )
 done:
 	DestroySoftwareLists();
 
-	if( sSubkeyName ) HeapFree( g_hProcessHeap, NULL, sSubkeyName );
-	if( hSoftwareListKey ) RegCloseKey( hSoftwareListKey );
-
 	return result;
 }
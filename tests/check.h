@@ -0,0 +1,46 @@
+// ----------------------------------------------------------------------------
+//  File name: check.h
+//
+//  Assertion macros shared by the Linux unit tests. Each test includes
+//  instsoft.cpp directly so it can reach the file's internal functions.
+// ----------------------------------------------------------------------------
+#ifndef INSTSOFT_TEST_CHECK_H
+#define INSTSOFT_TEST_CHECK_H
+
+#include <stdio.h>
+#include <string>
+
+static int g_nChecks = 0;
+static int g_nFailures = 0;
+
+#define CHECK( expr ) \
+	do \
+	{ \
+		g_nChecks++; \
+		if( !(expr) ) \
+		{ \
+			g_nFailures++; \
+			fprintf( stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #expr ); \
+		} \
+	} while( 0 )
+
+#define CHECK_TEXT( actual, expected ) \
+	do \
+	{ \
+		g_nChecks++; \
+		if( std::u16string( (const char16_t*)(actual) ) != std::u16string( (const char16_t*)(expected) ) ) \
+		{ \
+			g_nFailures++; \
+			fprintf( stderr, "%s:%d: CHECK_TEXT failed: %s == %s\n", __FILE__, __LINE__, #actual, #expected ); \
+		} \
+	} while( 0 )
+
+// Prints the summary line and returns the process exit code.
+static int ReportChecks( const char* sName )
+{
+	printf( "%s: %d checks, %d failed\n", sName, g_nChecks, g_nFailures );
+
+	return g_nFailures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,122 @@
+// ----------------------------------------------------------------------------
+//  File name: encode_bench.cpp
+//
+//  Times WriteOutputStringN with and without the SSE2 fast path over three
+//  kinds of field: plain ASCII display names, names with accented and CJK
+//  characters, and text heavy with characters that need escaping.
+// ----------------------------------------------------------------------------
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "../instsoft.cpp"
+
+#define BENCH_FIELDS	4096
+#define BENCH_ROUNDS	200
+
+typedef std::vector<std::u16string> FIELDS;
+
+static FIELDS MakeFields( int nKind )
+{
+	static const char16_t* const sAscii[] =
+	{
+		u"Microsoft Visual C++ 2015-2022 Redistributable (x64) - 14.38.33130",
+		u"Google Chrome", u"7-Zip 23.01 (x64)", u"Notepad++ (64-bit x64)",
+		u"Windows Software Development Kit - Windows 10.0.22621.2428",
+		u"Mozilla Firefox (x64 en-US)", u"Git", u"Python 3.12.1 (64-bit)",
+	};
+	static const char16_t* const sMixed[] =
+	{
+		u"Microsoft Office Professionnel Plus 2019 - fr-fr", u"Lenovo Vantage Service",
+		u"Logiciel de gestion d'\u00e9nergie", u"\u30de\u30a4\u30af\u30ed\u30bd\u30d5\u30c8 Edge",
+		u"Adobe Acrobat (64-bit) \u2013 Deutsch", u"Paquete de idioma espa\u00f1ol",
+		u"\u4e2d\u6587\u8f93\u5165\u6cd5 2.1", u"Microsoft Teams classic",
+	};
+	static const char16_t* const sEscaped[] =
+	{
+		u"C:\\Program Files\\Vendor\\App\\bin\\app.exe \"%1\"",
+		u"\"C:\\Windows\\System32\\msiexec.exe\" /X{12345678-ABCD-EF01}",
+		u"Line one\r\nLine two\tTabbed", u"Quote \"inside\" and \\back\\slashes\\",
+	};
+	const char16_t* const* sSource = (0 == nKind) ? sAscii : (1 == nKind) ? sMixed : sEscaped;
+	int nSource = (0 == nKind) ? 8 : (1 == nKind) ? 8 : 4;
+	FIELDS tFields;
+
+	for( int i = 0; i < BENCH_FIELDS; i++ ) tFields.push_back( sSource[i % nSource] );
+
+	return tFields;
+}
+
+static double TimeFields( const FIELDS& tFields, OUTPUT_FORMAT nFormat, BOOL bSse2, DWORD* pBytes )
+{
+	static BYTE pData[OUTPUT_BUFFER_SIZE];
+	FILE* hNull = fopen( "/dev/null", "wb" );
+	OUTPUT_BUFFER tOutput;
+	double nBest = 1e30;
+
+	g_bSse2 = bSse2;
+	*pBytes = 0;
+
+	for( size_t i = 0; i < tFields.size(); i++ ) *pBytes += (DWORD)tFields[i].size() * 2;
+
+	// Best of five to keep scheduler noise out of the figure.
+	for( int nTrial = 0; nTrial < 5; nTrial++ )
+	{
+		std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+
+		ZeroMemory( &tOutput, sizeof(tOutput) );
+		tOutput.hFile = hNull;
+		tOutput.Data = pData;
+		tOutput.Capacity = OUTPUT_BUFFER_SIZE;
+
+		for( int nRound = 0; nRound < BENCH_ROUNDS; nRound++ )
+		{
+			for( size_t i = 0; i < tFields.size(); i++ )
+			{
+				WriteOutputStringN( &tOutput, (const WCHAR*)tFields[i].data(), (DWORD)tFields[i].size(), nFormat );
+			}
+		}
+
+		FlushOutputBuffer( &tOutput );
+
+		double nSeconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - tStart ).count();
+		if( nSeconds < nBest ) nBest = nSeconds;
+	}
+
+	fclose( hNull );
+
+	return nBest;
+}
+
+int main()
+{
+	static const char* const sKinds[] = { "ascii", "mixed", "escaped" };
+	static const char* const sFormats[] = { "text", "csv", "json" };
+
+	g_hProcessHeap = GetProcessHeap();
+
+	printf( "%-8s %-5s %12s %12s %8s\n", "fields", "fmt", "scalar MB/s", "sse2 MB/s", "speedup" );
+
+	for( int nKind = 0; nKind < 3; nKind++ )
+	{
+		FIELDS tFields = MakeFields( nKind );
+
+		for( int nFormat = OUTPUT_CSV; nFormat <= OUTPUT_JSON; nFormat++ )
+		{
+			DWORD nBytes;
+			double nScalar = TimeFields( tFields, (OUTPUT_FORMAT)nFormat, FALSE, &nBytes );
+			double nVector = TimeFields( tFields, (OUTPUT_FORMAT)nFormat, TRUE, &nBytes );
+			double nMegabytes = (double)nBytes * BENCH_ROUNDS / (1024.0 * 1024.0);
+
+			printf( "%-8s %-5s %12.1f %12.1f %7.2fx\n",
+					sKinds[nKind],
+					sFormats[nFormat],
+					nMegabytes / nScalar,
+					nMegabytes / nVector,
+					nScalar / nVector );
+		}
+	}
+
+	return 0;
+}
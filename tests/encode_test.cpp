@@ -0,0 +1,337 @@
+// ----------------------------------------------------------------------------
+//  File name: encode_test.cpp
+//
+//  Round-trips adversarial UTF-16 through WriteOutputStringN for CSV and
+//  JSON. Surrogates, control characters, quotes and backslashes are put at
+//  every offset across three 8-unit blocks, alone and in pairs, and the
+//  SSE2 and scalar paths must give the same bytes.
+// ----------------------------------------------------------------------------
+#include <stdlib.h>
+#include <vector>
+
+#include "check.h"
+#include "../instsoft.cpp"
+
+#define TEST_LENGTH		24
+
+typedef std::vector<DWORD> CODE_POINTS;
+
+// Units that each need more than a narrowing copy, or sit on the edge of
+// the plain range the vector compare accepts.
+static const WCHAR g_tSpecial[] =
+{
+	0x0000, 0x0001, '\b', '\t', '\n', '\f', '\r', 0x001F,
+	' ', '"', '\\', '~', 0x007F, 0x0080, 0x07FF, 0x0800,
+	0x7FFF, 0x8000, 0xD800, 0xDBFF, 0xDC00, 0xDFFF, 0xFFFD, 0xFFFF
+};
+static const DWORD g_nSpecial = sizeof(g_tSpecial) / sizeof(g_tSpecial[0]);
+
+static std::vector<BYTE> Encode( const std::u16string& sValue, OUTPUT_FORMAT nFormat, BOOL bSse2 )
+{
+	static BYTE pData[OUTPUT_BUFFER_SIZE];
+	OUTPUT_BUFFER tOutput;
+
+	ZeroMemory( &tOutput, sizeof(tOutput) );
+	tOutput.Data = pData;
+	tOutput.Capacity = OUTPUT_BUFFER_SIZE;
+
+	g_bSse2 = bSse2;
+	WriteOutputStringN( &tOutput, (const WCHAR*)sValue.data(), (DWORD)sValue.size(), nFormat );
+
+	return std::vector<BYTE>( pData, pData + tOutput.Size );
+}
+
+// What the encoder should preserve: code points, with unpaired surrogates
+// replaced by U+FFFD.
+static CODE_POINTS ExpectedPoints( const std::u16string& sValue )
+{
+	CODE_POINTS tPoints;
+
+	for( size_t i = 0; i < sValue.size(); i++ )
+	{
+		DWORD c = sValue[i];
+
+		if( (c >= 0xD800) && (c <= 0xDBFF) && (i + 1 < sValue.size()) &&
+			(sValue[i + 1] >= 0xDC00) && (sValue[i + 1] <= 0xDFFF) )
+		{
+			c = 0x10000 + ((c - 0xD800) << 10) + (sValue[++i] - 0xDC00);
+		}
+		else if( (c >= 0xD800) && (c <= 0xDFFF) )
+		{
+			c = 0xFFFD;
+		}
+
+		tPoints.push_back( c );
+	}
+
+	return tPoints;
+}
+
+// Strict UTF-8 decoder: rejects overlong forms, surrogates and truncation.
+static BOOL DecodeUtf8( const std::vector<BYTE>& tBytes, CODE_POINTS* pPoints )
+{
+	size_t i = 0;
+
+	while( i < tBytes.size() )
+	{
+		DWORD c = tBytes[i++];
+		DWORD nMore, nMin;
+
+		if( c < 0x80 )					{ nMore = 0; nMin = 0; }
+		else if( (c & 0xE0) == 0xC0 )	{ nMore = 1; nMin = 0x80; c &= 0x1F; }
+		else if( (c & 0xF0) == 0xE0 )	{ nMore = 2; nMin = 0x800; c &= 0x0F; }
+		else if( (c & 0xF8) == 0xF0 )	{ nMore = 3; nMin = 0x10000; c &= 0x07; }
+		else return FALSE;
+
+		for( ; nMore; nMore-- )
+		{
+			if( (i >= tBytes.size()) || ((tBytes[i] & 0xC0) != 0x80) ) return FALSE;
+
+			c = (c << 6) | (tBytes[i++] & 0x3F);
+		}
+
+		if( (c < nMin) || (c > 0x10FFFF) || ((c >= 0xD800) && (c <= 0xDFFF)) ) return FALSE;
+
+		pPoints->push_back( c );
+	}
+
+	return TRUE;
+}
+
+// Undoes CSV quoting inside a quoted field: "" is a quote, a lone quote is
+// an error, everything else is literal.
+static BOOL UnescapeCsv( const CODE_POINTS& tIn, CODE_POINTS* pOut )
+{
+	for( size_t i = 0; i < tIn.size(); i++ )
+	{
+		if( '"' == tIn[i] )
+		{
+			if( (i + 1 >= tIn.size()) || ('"' != tIn[i + 1]) ) return FALSE;
+			i++;
+		}
+
+		pOut->push_back( tIn[i] );
+	}
+
+	return TRUE;
+}
+
+// Undoes JSON string escapes. Raw quotes, backslashes and control
+// characters are errors, as a JSON parser would treat them.
+static BOOL UnescapeJson( const CODE_POINTS& tIn, CODE_POINTS* pOut )
+{
+	for( size_t i = 0; i < tIn.size(); i++ )
+	{
+		DWORD c = tIn[i];
+
+		if( ('"' == c) || (c < 0x20) ) return FALSE;
+
+		if( '\\' != c )
+		{
+			pOut->push_back( c );
+			continue;
+		}
+
+		if( ++i >= tIn.size() ) return FALSE;
+
+		switch( tIn[i] )
+		{
+		case '"':	pOut->push_back( '"' ); break;
+		case '\\':	pOut->push_back( '\\' ); break;
+		case '/':	pOut->push_back( '/' ); break;
+		case 'b':	pOut->push_back( '\b' ); break;
+		case 'f':	pOut->push_back( '\f' ); break;
+		case 'n':	pOut->push_back( '\n' ); break;
+		case 'r':	pOut->push_back( '\r' ); break;
+		case 't':	pOut->push_back( '\t' ); break;
+		case 'u':
+			{
+				DWORD nValue = 0;
+
+				if( i + 4 >= tIn.size() ) return FALSE;
+
+				for( int j = 0; j < 4; j++ )
+				{
+					DWORD h = tIn[++i];
+
+					if( (h >= '0') && (h <= '9') ) nValue = (nValue << 4) | (h - '0');
+					else if( (h >= 'a') && (h <= 'f') ) nValue = (nValue << 4) | (h - 'a' + 10);
+					else return FALSE;
+				}
+
+				pOut->push_back( nValue );
+			}
+			break;
+		default:
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL RoundTrips( const std::u16string& sValue, OUTPUT_FORMAT nFormat )
+{
+	std::vector<BYTE> tScalar = Encode( sValue, nFormat, FALSE );
+	std::vector<BYTE> tVector = Encode( sValue, nFormat, TRUE );
+	CODE_POINTS tDecoded, tUnescaped;
+
+	if( tScalar != tVector ) return FALSE;
+	if( !DecodeUtf8( tScalar, &tDecoded ) ) return FALSE;
+
+	if( OUTPUT_CSV == nFormat )
+	{
+		if( !UnescapeCsv( tDecoded, &tUnescaped ) ) return FALSE;
+	}
+	else
+	{
+		if( !UnescapeJson( tDecoded, &tUnescaped ) ) return FALSE;
+	}
+
+	return tUnescaped == ExpectedPoints( sValue );
+}
+
+static std::u16string PlainString()
+{
+	std::u16string sValue;
+
+	for( int i = 0; i < TEST_LENGTH; i++ ) sValue += (char16_t)('a' + i);
+
+	return sValue;
+}
+
+static void CheckRoundTrip( const std::u16string& sValue, int* pFailures )
+{
+	BOOL bCsv = RoundTrips( sValue, OUTPUT_CSV );
+	BOOL bJson = RoundTrips( sValue, OUTPUT_JSON );
+
+	g_nChecks += 2;
+
+	if( bCsv && bJson ) return;
+
+	g_nFailures += !bCsv + !bJson;
+
+	// Report only the first few so a regression stays readable.
+	if( (*pFailures)++ < 8 )
+	{
+		fprintf( stderr, "round trip failed (%s%s):", bCsv ? "" : "csv ", bJson ? "" : "json" );
+		for( size_t i = 0; i < sValue.size(); i++ ) fprintf( stderr, " %04x", (unsigned)sValue[i] );
+		fprintf( stderr, "\n" );
+	}
+}
+
+static void TestSingle()
+{
+	int nFailures = 0;
+
+	for( DWORD s = 0; s < g_nSpecial; s++ )
+	{
+		for( int i = 0; i < TEST_LENGTH; i++ )
+		{
+			std::u16string sValue = PlainString();
+
+			sValue[i] = g_tSpecial[s];
+			CheckRoundTrip( sValue, &nFailures );
+
+			// The same unit as the last one in a shorter string.
+			CheckRoundTrip( sValue.substr( 0, i + 1 ), &nFailures );
+		}
+	}
+}
+
+static void TestPairs()
+{
+	int nFailures = 0;
+
+	// Every ordered pair of special units at every pair of offsets. This
+	// covers surrogate pairs split across an 8-unit block, reversed pairs
+	// and high surrogates followed by something else.
+	for( DWORD s = 0; s < g_nSpecial; s++ )
+	{
+		for( DWORD t = 0; t < g_nSpecial; t++ )
+		{
+			for( int i = 0; i < TEST_LENGTH; i++ )
+			{
+				for( int j = 0; j < TEST_LENGTH; j++ )
+				{
+					std::u16string sValue = PlainString();
+
+					if( i == j ) continue;
+
+					sValue[i] = g_tSpecial[s];
+					sValue[j] = g_tSpecial[t];
+					CheckRoundTrip( sValue, &nFailures );
+				}
+			}
+		}
+	}
+}
+
+static void TestRandom()
+{
+	int nFailures = 0;
+
+	srand( 12345 );
+
+	// Dense mixes from a small alphabet weighted toward the edge cases.
+	for( int n = 0; n < 20000; n++ )
+	{
+		std::u16string sValue;
+		int nLength = rand() % (3 * TEST_LENGTH);
+
+		for( int i = 0; i < nLength; i++ )
+		{
+			sValue += (rand() % 3) ? (char16_t)('A' + rand() % 26) : (char16_t)g_tSpecial[rand() % g_nSpecial];
+		}
+
+		CheckRoundTrip( sValue, &nFailures );
+	}
+}
+
+static void TestFlush()
+{
+	static BYTE pSmall[OUTPUT_CHUNK_SIZE * 2];
+	std::u16string sValue;
+	std::vector<BYTE> tExpected, tWritten;
+	OUTPUT_BUFFER tOutput;
+	FILE* hFile = tmpfile();
+
+	for( int i = 0; i < 5000; i++ ) sValue += (char16_t)((i % 7) ? ('a' + i % 26) : g_tSpecial[i % g_nSpecial]);
+
+	tExpected = Encode( sValue, OUTPUT_JSON, FALSE );
+
+	// A buffer only twice the chunk size flushes many times mid-string.
+	for( int bSse2 = 0; bSse2 < 2; bSse2++ )
+	{
+		ZeroMemory( &tOutput, sizeof(tOutput) );
+		tOutput.hFile = hFile;
+		tOutput.Data = pSmall;
+		tOutput.Capacity = sizeof(pSmall);
+
+		rewind( hFile );
+		g_bSse2 = bSse2;
+
+		WriteOutputStringN( &tOutput, (const WCHAR*)sValue.data(), (DWORD)sValue.size(), OUTPUT_JSON );
+		FlushOutputBuffer( &tOutput );
+
+		tWritten.assign( tExpected.size(), 0 );
+		rewind( hFile );
+
+		CHECK( fread( tWritten.data(), 1, tWritten.size(), hFile ) == tExpected.size() );
+		CHECK( tWritten == tExpected );
+	}
+
+	fclose( hFile );
+}
+
+int main()
+{
+	g_hProcessHeap = GetProcessHeap();
+
+	TestSingle();
+	TestPairs();
+	TestRandom();
+	TestFlush();
+
+	return ReportChecks( "encode_test" );
+}
@@ -0,0 +1,78 @@
+// ----------------------------------------------------------------------------
+//  File name: fleet_bench.cpp
+//
+//  Runs the real fleet coordinator, built as ./instsoft, over a host list
+//  against the synthetic backend with 1 to 128 worker processes, and
+//  reports hosts per second and the speedup over a single worker. With a
+//  fixed latency per host the run is bound by waiting, so throughput should
+//  scale with the workers until the coordinator's own work shows.
+// ----------------------------------------------------------------------------
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <string>
+
+#include "../instsoft.cpp"
+
+#define BENCH_HOSTS		500
+#define BENCH_LATENCY	4
+#define BENCH_WORKERS	128
+
+typedef std::chrono::steady_clock CLOCK;
+
+int main()
+{
+	char sDirectory[] = "/tmp/fleet_benchXXXXXX";
+	std::string sHosts;
+	char sCommand[512];
+	FILE* hFile;
+	double nBaseline = 0;
+
+	if( access( "./instsoft", X_OK ) != 0 )
+	{
+		fprintf( stderr, "fleet_bench: build ./instsoft first\n" );
+		return 1;
+	}
+
+	sHosts = std::string( mkdtemp( sDirectory ) ) + "/hosts.txt";
+
+	hFile = fopen( sHosts.c_str(), "w" );
+	for( int i = 0; i < BENCH_HOSTS; i++ ) fprintf( hFile, "host%04d\n", i );
+	fclose( hFile );
+
+	printf( "%u hosts, %u ms each\n", BENCH_HOSTS, BENCH_LATENCY );
+	printf( "%-8s %12s %8s\n", "workers", "hosts/s", "speedup" );
+
+	for( int nWorkers = 1; nWorkers <= BENCH_WORKERS; nWorkers *= 2 )
+	{
+		double nBest = 1e30;
+
+		snprintf( sCommand, sizeof(sCommand), "./instsoft /m %s /n %d /x %d > /dev/null", sHosts.c_str(), nWorkers, BENCH_LATENCY );
+
+		// Best of three to keep scheduler noise out of the figure.
+		for( int nTrial = 0; nTrial < 3; nTrial++ )
+		{
+			CLOCK::time_point tStart = CLOCK::now();
+			int nStatus = system( sCommand );
+
+			// One synthetic host in 32 fails on purpose, so -1 is a clean run.
+			if( !WIFEXITED( nStatus ) || ((0 != WEXITSTATUS( nStatus )) && (255 != WEXITSTATUS( nStatus ))) )
+			{
+				fprintf( stderr, "fleet_bench: %s failed\n", sCommand );
+				return 1;
+			}
+
+			nBest = min( nBest, std::chrono::duration<double>( CLOCK::now() - tStart ).count() );
+		}
+
+		if( 1 == nWorkers ) nBaseline = nBest;
+
+		printf( "%-8d %12.1f %7.2fx\n", nWorkers, BENCH_HOSTS / nBest, nBaseline / nBest );
+	}
+
+	unlink( sHosts.c_str() );
+	rmdir( sDirectory );
+
+	return 0;
+}
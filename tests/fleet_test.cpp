@@ -0,0 +1,382 @@
+// ----------------------------------------------------------------------------
+//  File name: fleet_test.cpp
+//
+//  Checks the coordinator's bookkeeping without worker processes: every
+//  host is handed out exactly once, reports are written in host list order
+//  as soon as nothing earlier holds them back, and their buffers are freed
+//  once written. Also checks that the synthetic registry backend used for
+//  load testing is deterministic.
+// ----------------------------------------------------------------------------
+#include <unistd.h>
+#include <vector>
+
+#include "check.h"
+#include "../instsoft.cpp"
+
+#define HOST_COUNT	1000
+
+static DWORD NextRandom( DWORD* pSeed )
+{
+	*pSeed = *pSeed * 1103515245 + 12345;
+
+	return *pSeed >> 8;
+}
+
+static void SetUpFleet( DWORD nWorkers )
+{
+	g_pFleetHosts = (PFLEET_HOST)HeapAlloc( g_hProcessHeap, HEAP_ZERO_MEMORY, sizeof(FLEET_HOST) * HOST_COUNT );
+	g_nFleetHosts = HOST_COUNT;
+
+	for( DWORD i = 0; i < HOST_COUNT; i++ )
+	{
+		StringCchPrintf( g_pFleetHosts[i].ComputerName, COMPUTER_NAME_LENGTH, TEXT("HOST%u"), i );
+	}
+
+	g_pFleetPending = (LONG*)HeapAlloc( g_hProcessHeap, 0, sizeof(LONG) * HOST_COUNT );
+	g_nFleetPending = 0;
+
+	// Every third host is already done, as after a resume.
+	for( DWORD i = 0; i < HOST_COUNT; i++ )
+	{
+		if( i % 3 ) g_pFleetPending[g_nFleetPending++] = (LONG)i;
+	}
+
+	g_pFleetShards = (PFLEET_SHARD)HeapAlloc( g_hProcessHeap, HEAP_ZERO_MEMORY, sizeof(FLEET_SHARD) * nWorkers );
+
+	for( DWORD i = 0; i < nWorkers; i++ )
+	{
+		g_pFleetShards[i].Begin = 0;
+		g_pFleetShards[i].End = (LONG)((g_nFleetPending - i + nWorkers - 1) / nWorkers);
+	}
+
+	g_nFleetWorkers = nWorkers;
+	InitializeCriticalSection( &g_csFleet );
+}
+
+static void TearDownFleet()
+{
+	DeleteCriticalSection( &g_csFleet );
+
+	for( DWORD i = 0; i < g_nFleetHosts; i++ )
+	{
+		if( g_pFleetHosts[i].Output ) HeapFree( g_hProcessHeap, NULL, g_pFleetHosts[i].Output );
+	}
+
+	HeapFree( g_hProcessHeap, NULL, g_pFleetHosts );
+	HeapFree( g_hProcessHeap, NULL, g_pFleetPending );
+	HeapFree( g_hProcessHeap, NULL, g_pFleetShards );
+
+	g_pFleetHosts = NULL;
+	g_pFleetPending = NULL;
+	g_pFleetShards = NULL;
+	g_nFleetHosts = 0;
+	g_nFleetPending = 0;
+	g_nFleetWritten = 0;
+	g_nFleetFailed = 0;
+}
+
+static void TestTakeFleetHost()
+{
+	static const DWORD nWorkerCounts[] = { 1, 2, 7, 64, 65, 200 };
+
+	for( DWORD n = 0; n < sizeof(nWorkerCounts) / sizeof(nWorkerCounts[0]); n++ )
+	{
+		DWORD nWorkers = nWorkerCounts[n];
+		std::vector<int> tTaken( HOST_COUNT, 0 );
+		std::vector<LONG> tPosition( HOST_COUNT, -1 );
+		std::vector<LONG> tLast( nWorkers, -1 );
+		DWORD nSeed = n;
+		DWORD nTaken = 0;
+		BOOL bOrdered = TRUE;
+		LONG nHost;
+
+		SetUpFleet( nWorkers );
+
+		for( DWORD i = 0; i < g_nFleetPending; i++ ) tPosition[g_pFleetPending[i]] = (LONG)i;
+
+		// Workers ask in a random order; the first quarter of them never
+		// ask at all, as if they had died, so their shards get stolen.
+		for( ;; )
+		{
+			DWORD nWorker = nWorkers / 4 + NextRandom( &nSeed ) % (nWorkers - nWorkers / 4);
+
+			nHost = TakeFleetHost( nWorker );
+			if( nHost < 0 ) break;
+
+			tTaken[nHost]++;
+			nTaken++;
+
+			// Each shard is handed out in list order, whoever takes from it.
+			DWORD nShard = (DWORD)tPosition[nHost] % nWorkers;
+
+			if( nHost <= tLast[nShard] ) bOrdered = FALSE;
+			tLast[nShard] = nHost;
+		}
+
+		CHECK( g_nFleetPending == nTaken );
+		CHECK( bOrdered );
+
+		for( DWORD i = 0; i < HOST_COUNT; i++ )
+		{
+			CHECK( tTaken[i] == ((i % 3) ? 1 : 0) );
+		}
+
+		// Once everything is handed out, every worker gets nothing.
+		for( DWORD i = 0; i < nWorkers; i++ ) CHECK( TakeFleetHost( i ) < 0 );
+
+		TearDownFleet();
+	}
+}
+
+static void TestStreaming()
+{
+	char sPath[] = "/tmp/fleet_testXXXXXX";
+	TCHAR sWidePath[64];
+	std::string sExpected;
+	std::vector<LONG> tInFlight;
+	DWORD nSeed = 42;
+	DWORD nHeld = 0;
+	DWORD nMostHeld = 0;
+	BOOL bWrittenFreed = TRUE;
+	BOOL bPrefix = TRUE;
+	char sReport[128];
+	FILE* hFile;
+
+	close( mkstemp( sPath ) );
+	for( int i = 0; ; i++ )
+	{
+		sWidePath[i] = (TCHAR)sPath[i];
+		if( !sPath[i] ) break;
+	}
+
+	SetUpFleet( 8 );
+	InitializeCriticalSection( &g_csFleetOutput );
+
+	g_nOutputFormat = OUTPUT_TEXT;
+	g_hFleetOutput = CreateFile( sWidePath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+	CHECK( INVALID_HANDLE_VALUE != g_hFleetOutput );
+
+	// Resumed hosts carry their report already.
+	for( DWORD i = 0; i < HOST_COUNT; i++ )
+	{
+		if( i % 3 ) continue;
+
+		snprintf( sReport, sizeof(sReport), "resumed %u\n", i );
+		AppendFleetOutput( &g_pFleetHosts[i], (const BYTE*)sReport, (DWORD)strlen( sReport ) );
+		g_pFleetHosts[i].Done = TRUE;
+	}
+
+	EnterCriticalSection( &g_csFleetOutput );
+	WriteFleetReports( FALSE );
+	LeaveCriticalSection( &g_csFleetOutput );
+
+	CHECK( 1 == g_nFleetWritten );
+
+	// Eight workers each hold one host at a time and finish them in a
+	// random order. Host 998 is never finished.
+	for( DWORD i = 0; i < 8; i++ ) tInFlight.push_back( TakeFleetHost( i ) );
+
+	for( ;; )
+	{
+		DWORD nWorker = NextRandom( &nSeed ) % 8;
+		LONG nHost = tInFlight[nWorker];
+		PFLEET_HOST pHost;
+
+		if( nHost < 0 )
+		{
+			BOOL bBusy = FALSE;
+
+			for( DWORD i = 0; i < 8; i++ ) if( tInFlight[i] >= 0 ) bBusy = TRUE;
+			if( !bBusy ) break;
+			continue;
+		}
+
+		tInFlight[nWorker] = TakeFleetHost( nWorker );
+		if( 998 == nHost ) continue;
+
+		pHost = &g_pFleetHosts[nHost];
+
+		if( 0 == nHost % 50 )
+		{
+			pHost->Result = ERROR_ACCESS_DENIED;
+		}
+		else
+		{
+			snprintf( sReport, sizeof(sReport), "report %u\n", nHost );
+			AppendFleetOutput( pHost, (const BYTE*)sReport, (DWORD)strlen( sReport ) );
+		}
+
+		FinishFleetHost( pHost );
+
+		// Everything before the first unfinished host is out and freed.
+		for( DWORD k = 0; k < g_nFleetWritten; k++ )
+		{
+			if( g_pFleetHosts[k].Output ) bWrittenFreed = FALSE;
+		}
+
+		if( (g_nFleetWritten < HOST_COUNT) && g_pFleetHosts[g_nFleetWritten].Done ) bPrefix = FALSE;
+
+		// Resumed reports are not counted: they were loaded up front.
+		nHeld = 0;
+		for( DWORD k = g_nFleetWritten; k < HOST_COUNT; k++ )
+		{
+			if( (k % 3) && g_pFleetHosts[k].Done && g_pFleetHosts[k].Output ) nHeld++;
+		}
+
+		nMostHeld = max( nMostHeld, nHeld );
+	}
+
+	CHECK( bWrittenFreed );
+	CHECK( bPrefix );
+	CHECK( 998 == g_nFleetWritten );
+
+	// Only the reports finished while an earlier host was still running are
+	// held, a number set by how long one host stays in flight and not by
+	// the size of the run.
+	CHECK( nMostHeld < 64 );
+
+	EnterCriticalSection( &g_csFleetOutput );
+	WriteFleetReports( TRUE );
+	LeaveCriticalSection( &g_csFleetOutput );
+
+	CHECK( HOST_COUNT == g_nFleetWritten );
+	CloseHandle( g_hFleetOutput );
+
+	for( DWORD i = 0; i < HOST_COUNT; i++ )
+	{
+		if( 0 == i % 3 )
+		{
+			snprintf( sReport, sizeof(sReport), "resumed %u\n", i );
+		}
+		else if( (0 == i % 50) || (998 == i) )
+		{
+			snprintf( sReport,
+					  sizeof(sReport),
+					  "Computer name: HOST%u\r\nFailed to collect software (error %d)\r\n\r\n",
+					  i,
+					  (998 == i) ? ERROR_BROKEN_PIPE : ERROR_ACCESS_DENIED );
+		}
+		else
+		{
+			snprintf( sReport, sizeof(sReport), "report %u\n", i );
+		}
+
+		sExpected += sReport;
+	}
+
+	std::string sActual;
+	hFile = fopen( sPath, "rb" );
+	for( int c; (c = fgetc( hFile )) != EOF; ) sActual += (char)c;
+	fclose( hFile );
+	unlink( sPath );
+
+	CHECK( sActual == sExpected );
+
+	DeleteCriticalSection( &g_csFleetOutput );
+	TearDownFleet();
+}
+
+static std::u16string CollectFake( const TCHAR* sComputerName, LONG* pResult )
+{
+	std::u16string sList;
+
+	*pResult = CollectSoftwareLists( sComputerName, TRUE );
+
+	for( PSOFTWARE_DATA_NODE pCurrent = g_pSoftwareListHead; pCurrent; pCurrent = pCurrent->Next )
+	{
+		sList += (const char16_t*)pCurrent->Data.DisplayName;
+		sList += u'|';
+		sList += (const char16_t*)pCurrent->Data.DisplayVersion;
+		sList += u'\n';
+	}
+
+	DestroySoftwareLists();
+
+	return sList;
+}
+
+static void TestFakeRegistry()
+{
+	TCHAR sComputerName[COMPUTER_NAME_LENGTH];
+	DWORD nFailed = 0;
+	LONG result;
+	LONG result2;
+
+	g_bFakeRegistry = TRUE;
+	g_nFakeLatency = 0;
+
+	for( DWORD i = 0; i < 256; i++ )
+	{
+		StringCchPrintf( sComputerName, COMPUTER_NAME_LENGTH, TEXT("host%u"), i );
+
+		std::u16string sFirst = CollectFake( sComputerName, &result );
+
+		// The same host gives the same records, whatever the case.
+		sComputerName[0] = TEXT('H');
+		std::u16string sSecond = CollectFake( sComputerName, &result2 );
+
+		CHECK( result == result2 );
+		CHECK( sFirst == sSecond );
+
+		if( ERROR_SUCCESS != result )
+		{
+			nFailed++;
+			CHECK( sFirst.empty() );
+		}
+		else
+		{
+			CHECK( !sFirst.empty() );
+		}
+	}
+
+	// About one host in 32 fails.
+	CHECK( (nFailed > 0) && (nFailed < 32) );
+
+	// Synthetic records go through the usual filtering.
+	g_sOlderThan = TEXT("5.0");
+	ParseVersionKey( g_sOlderThan, &g_tOlderThan );
+
+	CHECK( ERROR_SUCCESS == CollectSoftwareLists( TEXT("host1"), TRUE ) );
+	for( PSOFTWARE_DATA_NODE pCurrent = g_pSoftwareListHead; pCurrent; pCurrent = pCurrent->Next )
+	{
+		CHECK( CompareVersionKeys( &pCurrent->Data.VersionKey, &g_tOlderThan ) < 0 );
+	}
+
+	DestroySoftwareLists();
+
+	g_sOlderThan = NULL;
+	g_bFakeRegistry = FALSE;
+}
+
+static void TestWorkerCommandLine()
+{
+	static TCHAR sLong[WORKER_COMMAND_LENGTH];
+	FLEET_WORKER tWorker;
+
+	for( DWORD i = 0; i < WORKER_COMMAND_LENGTH - 1; i++ ) sLong[i] = TEXT('9');
+
+	// A /v value too long for the command line fails the start instead of
+	// dropping the closing quote and /x from the worker's options.
+	ZeroMemory( &tWorker, sizeof(tWorker) );
+	g_sOlderThan = sLong;
+	g_bFakeRegistry = TRUE;
+
+	CHECK( !StartFleetWorker( &tWorker ) );
+	CHECK( NULL == tWorker.hProcess );
+	CHECK( NULL == tWorker.hInput );
+
+	g_sOlderThan = NULL;
+	g_bFakeRegistry = FALSE;
+}
+
+int main()
+{
+	g_hProcessHeap = GetProcessHeap();
+
+	TestTakeFleetHost();
+	TestStreaming();
+	TestFakeRegistry();
+	TestWorkerCommandLine();
+
+	return ReportChecks( "fleet_test" );
+}
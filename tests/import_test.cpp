@@ -0,0 +1,237 @@
+// ----------------------------------------------------------------------------
+//  File name: import_test.cpp
+//
+//  Imports a directory of saved text reports and checks the CSV: rows with
+//  an empty install date are kept, fields are converted from the ANSI code
+//  page to UTF-8, lines that are neither header nor rows are counted as
+//  skipped, and no row is lost with more threads than one wait can cover.
+// ----------------------------------------------------------------------------
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include "check.h"
+#include "../instsoft.cpp"
+
+static std::string g_sDirectory;
+
+static void WriteReport( const char* sName, const std::string& sContents )
+{
+	std::string sPath = g_sDirectory + "/" + sName;
+	FILE* hFile = fopen( sPath.c_str(), "wb" );
+
+	fwrite( sContents.data(), 1, sContents.size(), hFile );
+	fclose( hFile );
+}
+
+static std::string ReadFile( const std::string& sPath )
+{
+	std::string sContents;
+	FILE* hFile = fopen( sPath.c_str(), "rb" );
+
+	if( NULL == hFile ) return sContents;
+
+	for( int c; (c = fgetc( hFile )) != EOF; ) sContents += (char)c;
+	fclose( hFile );
+
+	return sContents;
+}
+
+static std::u16string Widen( const std::string& s )
+{
+	return std::u16string( s.begin(), s.end() );
+}
+
+static void TestImport()
+{
+	static const char sHeader[] = "Computer,Timestamp,InstallDate,DisplayName,DisplayVersion\r\n";
+	std::vector<std::string> tRows;
+	std::string sOutput = g_sDirectory + "/out.csv";
+	std::string sCsv;
+	size_t nStart;
+	int nResult;
+
+	// A report as DisplaySoftwareReport writes it, in the ANSI code page.
+	WriteReport( "HOST1_01022023-040506.txt",
+				 "Computer name: HOST1\n"
+				 "------------------------------------\n"
+				 "\n"
+				 "Install Date        Program Name\n"
+				 "\n"
+				 "20200101            Alpha App -- 1.2.3\n"
+				 "                    No Date App -- 2.0\n"
+				 "N/A                 Caf\xe9 \"Quoted\", Inc -- N/A\n"
+				 "N/A                 Split -- Name -- 5.1\n"
+				 "N/A                  Leading Space -- 6\n"
+				 "InstallDateTooLongXYZ Widget -- 4.0\n"
+				 "this line is not a row\n"
+				 "\n" );
+
+	// Fleet reports use CRLF and may hold failure notes.
+	WriteReport( "HOST2_12312022-235959.txt",
+				 "Computer name: HOST2\r\n"
+				 "Failed to collect software (error 5)\r\n"
+				 "\r\n"
+				 "20211231            Beta -- 9\r\n"
+				 "garbage" );
+
+	WriteReport( "not-a-report.txt", "20200101            Skipped -- 1\n" );
+	WriteReport( "EMPTY_01012020-000000.txt", "" );
+
+	std::u16string sDirectory = Widen( g_sDirectory );
+	std::u16string sFile = Widen( sOutput );
+
+	nResult = RunImport( (const TCHAR*)sDirectory.c_str(), (const TCHAR*)sFile.c_str() );
+	CHECK( ERROR_SUCCESS == nResult );
+
+	sCsv = ReadFile( sOutput );
+	CHECK( sCsv.compare( 0, sizeof(sHeader) - 1, sHeader ) == 0 );
+
+	// Rows from different reports may come in any order.
+	for( nStart = sizeof(sHeader) - 1; nStart < sCsv.size(); )
+	{
+		size_t nEnd = sCsv.find( "\r\n", nStart );
+		if( std::string::npos == nEnd ) break;
+
+		tRows.push_back( sCsv.substr( nStart, nEnd - nStart ) );
+		nStart = nEnd + 2;
+	}
+
+	std::sort( tRows.begin(), tRows.end() );
+
+	static const char* const sExpected[] =
+	{
+		"\"HOST1\",\"2023-01-02 04:05:06\",\"\",\"No Date App\",\"2.0\"",
+		"\"HOST1\",\"2023-01-02 04:05:06\",\"20200101\",\"Alpha App\",\"1.2.3\"",
+		"\"HOST1\",\"2023-01-02 04:05:06\",\"InstallDateTooLongXYZ\",\"Widget\",\"4.0\"",
+		"\"HOST1\",\"2023-01-02 04:05:06\",\"N/A\",\" Leading Space\",\"6\"",
+		"\"HOST1\",\"2023-01-02 04:05:06\",\"N/A\",\"Caf\xc3\xa9 \"\"Quoted\"\", Inc\",\"N/A\"",
+		"\"HOST1\",\"2023-01-02 04:05:06\",\"N/A\",\"Split -- Name\",\"5.1\"",
+		"\"HOST2\",\"2022-12-31 23:59:59\",\"20211231\",\"Beta\",\"9\"",
+	};
+	const size_t nExpected = sizeof(sExpected) / sizeof(sExpected[0]);
+
+	CHECK( nExpected == tRows.size() );
+
+	for( size_t i = 0; (i < nExpected) && (i < tRows.size()); i++ )
+	{
+		CHECK( tRows[i] == sExpected[i] );
+		if( tRows[i] != sExpected[i] ) fprintf( stderr, "  got: %s\n", tRows[i].c_str() );
+	}
+}
+
+static void TestCounts()
+{
+	IMPORT_JOB tJob;
+	OUTPUT_BUFFER tOutput;
+	WCHAR sField[64];
+	char sData[] =
+		"Computer name: HOST\n"
+		"------------------------------------\n"
+		"Install Date        Program Name\n"
+		"\n"
+		"                    Kept -- 1\n"
+		"no separator here\n"
+		"   \n"
+		"20200101            Kept Too -- 2";
+	LONG nSkippedRows = 0;
+	std::string sPath = g_sDirectory + "/counts.csv";
+	std::u16string sFile = Widen( sPath );
+
+	ZeroMemory( &tJob, sizeof(tJob) );
+	ZeroMemory( &tOutput, sizeof(tOutput) );
+
+	InitializeCriticalSection( &tJob.csOutput );
+
+	tOutput.hOutput = CreateFile( (const TCHAR*)sFile.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+	tOutput.pLock = &tJob.csOutput;
+	tOutput.Capacity = IMPORT_BUFFER_SIZE;
+	tOutput.Data = (PBYTE)HeapAlloc( g_hProcessHeap, 0, IMPORT_BUFFER_SIZE );
+
+	CHECK( 2 == ImportReport( &tOutput, sField, TEXT("HOST"), "2020-01-01 00:00:00", sData, sizeof(sData) - 1, &nSkippedRows ) );
+
+	// The header and blank lines are not rows; the other two lines are.
+	CHECK( 2 == nSkippedRows );
+
+	FlushOutputBuffer( &tOutput );
+	CloseHandle( tOutput.hOutput );
+	HeapFree( g_hProcessHeap, NULL, tOutput.Data );
+	DeleteCriticalSection( &tJob.csOutput );
+
+	CHECK( ReadFile( sPath ) ==
+		   "\"HOST\",\"2020-01-01 00:00:00\",\"\",\"Kept\",\"1\"\r\n"
+		   "\"HOST\",\"2020-01-01 00:00:00\",\"20200101\",\"Kept Too\",\"2\"\r\n" );
+
+	unlink( sPath.c_str() );
+}
+
+static void TestManyThreads()
+{
+	std::string sDirectory = g_sDirectory + "/many";
+	std::string sOutput = g_sDirectory + "/many.csv";
+	std::u16string sWideDirectory( sDirectory.begin(), sDirectory.end() );
+	std::u16string sFile( sOutput.begin(), sOutput.end() );
+	std::vector<std::string> tRows, tExpected;
+	std::string sCsv;
+	char sName[64];
+	char sRow[128];
+	size_t nStart;
+
+	mkdir( sDirectory.c_str(), 0700 );
+
+	for( int i = 0; i < 300; i++ )
+	{
+		std::string sReport = "Computer name: HOST\n\n";
+
+		snprintf( sName, sizeof(sName), "many/HOST%d_01022023-040506.txt", i );
+
+		for( int j = 0; j < 3; j++ )
+		{
+			snprintf( sRow, sizeof(sRow), "%-20sApp %d.%d -- %d\n", "20200101", i, j, j );
+			sReport += sRow;
+
+			snprintf( sRow, sizeof(sRow), "\"HOST%d\",\"2023-01-02 04:05:06\",\"20200101\",\"App %d.%d\",\"%d\"", i, i, j, j );
+			tExpected.push_back( sRow );
+		}
+
+		WriteReport( sName, sReport );
+	}
+
+	// More threads than one wait can cover.
+	ShimSetProcessorCount( 3 * MAXIMUM_WAIT_OBJECTS / 2 );
+	CHECK( ERROR_SUCCESS == RunImport( (const TCHAR*)sWideDirectory.c_str(), (const TCHAR*)sFile.c_str() ) );
+	ShimSetProcessorCount( 0 );
+
+	sCsv = ReadFile( sOutput );
+
+	for( nStart = sCsv.find( "\r\n" ) + 2; nStart < sCsv.size(); )
+	{
+		size_t nEnd = sCsv.find( "\r\n", nStart );
+		if( std::string::npos == nEnd ) break;
+
+		tRows.push_back( sCsv.substr( nStart, nEnd - nStart ) );
+		nStart = nEnd + 2;
+	}
+
+	std::sort( tRows.begin(), tRows.end() );
+	std::sort( tExpected.begin(), tExpected.end() );
+
+	CHECK( tRows == tExpected );
+}
+
+int main()
+{
+	char sDirectory[] = "/tmp/import_testXXXXXX";
+
+	g_hProcessHeap = GetProcessHeap();
+	g_sDirectory = mkdtemp( sDirectory );
+
+	TestImport();
+	TestCounts();
+	TestManyThreads();
+
+	system( ("rm -rf " + g_sDirectory).c_str() );
+
+	return ReportChecks( "import_test" );
+}
@@ -0,0 +1,31 @@
+// ----------------------------------------------------------------------------
+//  File name: instsoft_main.cpp
+//
+//  Builds instsoft.cpp as a Linux program, so the fleet coordinator can run
+//  real worker processes. The arguments are widened byte for byte, like
+//  the rest of the test build's code page.
+// ----------------------------------------------------------------------------
+#include <string>
+#include <vector>
+
+#include "../instsoft.cpp"
+
+int main( int argc, char** argv )
+{
+	std::vector<std::u16string> tArguments;
+	std::vector<TCHAR*> tArgv;
+
+	for( int i = 0; i < argc; i++ )
+	{
+		std::u16string sArgument;
+
+		for( const char* p = argv[i]; *p; p++ ) sArgument += (char16_t)(unsigned char)*p;
+
+		tArguments.push_back( sArgument );
+	}
+
+	for( int i = 0; i < argc; i++ ) tArgv.push_back( (TCHAR*)&tArguments[i][0] );
+	tArgv.push_back( NULL );
+
+	return _tmain( argc, tArgv.data() );
+}
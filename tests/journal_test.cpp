@@ -0,0 +1,516 @@
+// ----------------------------------------------------------------------------
+//  File name: journal_test.cpp
+//
+//  Writes a fleet journal, then cuts it short or corrupts one byte at every
+//  offset in turn and resumes from it. LoadFleetJournal must keep exactly
+//  the records before the damage, cut the file back to them, and collect
+//  hosts again when the journal was made with other report options. Then
+//  kills a real fleet run partway through and checks that resuming it
+//  gives the output of a run that was never interrupted.
+// ----------------------------------------------------------------------------
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "../instsoft.cpp"
+
+#define HOST_COUNT	8
+#define FLEET_HOSTS	200
+
+// The order hosts finish in, and so their order in the journal.
+static const DWORD g_nOrder[] = { 3, 0, 5, 1, 4, 2 };
+static const DWORD g_nRecords = sizeof(g_nOrder) / sizeof(g_nOrder[0]);
+
+static std::string g_sPath;
+static std::u16string g_sWidePath;
+
+static std::string ReportFor( DWORD nHost )
+{
+	std::string sReport;
+
+	// One empty report, the rest of assorted sizes.
+	for( DWORD i = 0; i < nHost * nHost * 37; i++ ) sReport += (char)('a' + (i + nHost) % 26);
+
+	return sReport;
+}
+
+static void SetUpHosts()
+{
+	g_pFleetHosts = (PFLEET_HOST)HeapAlloc( g_hProcessHeap, HEAP_ZERO_MEMORY, sizeof(FLEET_HOST) * HOST_COUNT );
+	g_nFleetHosts = HOST_COUNT;
+
+	for( DWORD i = 0; i < HOST_COUNT; i++ )
+	{
+		StringCchPrintf( g_pFleetHosts[i].ComputerName, COMPUTER_NAME_LENGTH, TEXT("host%u"), i );
+	}
+}
+
+static void TearDownHosts()
+{
+	for( DWORD i = 0; i < g_nFleetHosts; i++ )
+	{
+		if( g_pFleetHosts[i].Output ) HeapFree( g_hProcessHeap, NULL, g_pFleetHosts[i].Output );
+	}
+
+	HeapFree( g_hProcessHeap, NULL, g_pFleetHosts );
+
+	g_pFleetHosts = NULL;
+	g_nFleetHosts = 0;
+}
+
+static void CloseJournal()
+{
+	CloseHandle( g_hJournal );
+	DeleteCriticalSection( &g_csJournal );
+
+	g_hJournal = NULL;
+}
+
+static size_t FileSize( const std::string& sPath )
+{
+	struct stat tStat;
+
+	return (stat( sPath.c_str(), &tStat ) == 0) ? (size_t)tStat.st_size : 0;
+}
+
+static std::string ReadText( const std::string& sPath )
+{
+	std::string sContents;
+	FILE* hFile = fopen( sPath.c_str(), "rb" );
+
+	if( NULL == hFile ) return sContents;
+
+	for( int c; (c = fgetc( hFile )) != EOF; ) sContents += (char)c;
+	fclose( hFile );
+
+	return sContents;
+}
+
+// The journal warns on stderr about the damage the tests cause on purpose.
+static int g_hSavedStderr = -1;
+
+static void SilenceStderr()
+{
+	int hNull = open( "/dev/null", O_WRONLY );
+
+	fflush( stderr );
+	g_hSavedStderr = dup( 2 );
+	dup2( hNull, 2 );
+	close( hNull );
+}
+
+static void RestoreStderr()
+{
+	fflush( stderr );
+	dup2( g_hSavedStderr, 2 );
+	close( g_hSavedStderr );
+}
+
+// Writes the journal of a run that finished every host in g_nOrder, and
+// returns the file offset after each record.
+static std::vector<BYTE> WriteJournal( std::vector<size_t>* pEnds )
+{
+	std::vector<BYTE> tBytes;
+	FILE* hFile;
+
+	SetUpHosts();
+	CHECK( ERROR_SUCCESS == OpenFleetJournal( (const TCHAR*)g_sWidePath.c_str(), FALSE, TRUE ) );
+
+	pEnds->clear();
+	pEnds->push_back( 0 );
+
+	for( DWORD i = 0; i < g_nRecords; i++ )
+	{
+		PFLEET_HOST pHost = &g_pFleetHosts[g_nOrder[i]];
+		std::string sReport = ReportFor( g_nOrder[i] );
+
+		CHECK( AppendFleetOutput( pHost, (const BYTE*)sReport.data(), (DWORD)sReport.size() ) );
+		AppendJournalRecord( pHost );
+
+		pEnds->push_back( pEnds->back() + sizeof(JOURNAL_RECORD) + _tcslen( pHost->ComputerName ) * sizeof(TCHAR) + sReport.size() );
+	}
+
+	CloseJournal();
+	TearDownHosts();
+
+	hFile = fopen( g_sPath.c_str(), "rb" );
+	for( int c; (c = fgetc( hFile )) != EOF; ) tBytes.push_back( (BYTE)c );
+	fclose( hFile );
+
+	CHECK( tBytes.size() == pEnds->back() );
+
+	return tBytes;
+}
+
+static void WriteBytes( const std::vector<BYTE>& tBytes, size_t nSize )
+{
+	FILE* hFile = fopen( g_sPath.c_str(), "wb" );
+
+	fwrite( tBytes.data(), 1, nSize, hFile );
+	fclose( hFile );
+}
+
+// Resumes from the journal on disk with stderr silenced, then checks that
+// exactly the first nGood records were taken and the file was cut back to
+// nGoodSize bytes.
+static BOOL ResumeAndCheck( DWORD nGood, size_t nGoodSize )
+{
+	BOOL bPassed = TRUE;
+	LONG result;
+
+	SetUpHosts();
+
+	SilenceStderr();
+	result = OpenFleetJournal( (const TCHAR*)g_sWidePath.c_str(), TRUE, FALSE );
+	RestoreStderr();
+
+	if( ERROR_SUCCESS != result ) bPassed = FALSE;
+
+	for( DWORD i = 0; i < g_nRecords; i++ )
+	{
+		PFLEET_HOST pHost = &g_pFleetHosts[g_nOrder[i]];
+		std::string sReport = ReportFor( g_nOrder[i] );
+
+		if( pHost->Done != (i < nGood) ) bPassed = FALSE;
+
+		if( pHost->Done &&
+			((pHost->OutputSize != sReport.size()) ||
+			 (sReport.size() && memcmp( pHost->Output, sReport.data(), sReport.size() )) ||
+			 (ERROR_SUCCESS != pHost->Result)) ) bPassed = FALSE;
+	}
+
+	for( DWORD i = 0; i < HOST_COUNT; i++ )
+	{
+		if( g_pFleetHosts[i].Done && (g_pFleetHosts[i].OutputSize != ReportFor( i ).size()) ) bPassed = FALSE;
+	}
+
+	CloseJournal();
+	TearDownHosts();
+
+	if( FileSize( g_sPath ) != nGoodSize ) bPassed = FALSE;
+
+	return bPassed;
+}
+
+static void TestTruncation()
+{
+	std::vector<size_t> tEnds;
+	std::vector<BYTE> tBytes = WriteJournal( &tEnds );
+	DWORD nGood = 0;
+	int nFailures = 0;
+
+	for( size_t nSize = 0; nSize <= tBytes.size(); nSize++ )
+	{
+		while( (nGood < g_nRecords) && (tEnds[nGood + 1] <= nSize) ) nGood++;
+
+		WriteBytes( tBytes, nSize );
+
+		g_nChecks++;
+		if( !ResumeAndCheck( nGood, tEnds[nGood] ) )
+		{
+			g_nFailures++;
+			if( nFailures++ < 8 ) fprintf( stderr, "truncated to %u bytes: expected %u records\n", (DWORD)nSize, nGood );
+		}
+	}
+}
+
+static void TestCorruption()
+{
+	std::vector<size_t> tEnds;
+	std::vector<BYTE> tBytes = WriteJournal( &tEnds );
+	DWORD nGood = 0;
+	int nFailures = 0;
+
+	for( size_t nOffset = 0; nOffset < tBytes.size(); nOffset++ )
+	{
+		std::vector<BYTE> tDamaged( tBytes );
+
+		// The records wholly before the damaged byte survive.
+		while( tEnds[nGood + 1] <= nOffset ) nGood++;
+
+		for( int nFlip = 0; nFlip < 2; nFlip++ )
+		{
+			tDamaged[nOffset] = tBytes[nOffset] ^ (nFlip ? 0xFF : 0x01);
+			WriteBytes( tDamaged, tDamaged.size() );
+
+			g_nChecks++;
+			if( !ResumeAndCheck( nGood, tEnds[nGood] ) )
+			{
+				g_nFailures++;
+				if( nFailures++ < 8 ) fprintf( stderr, "byte %u corrupted: expected %u records\n", (DWORD)nOffset, nGood );
+			}
+		}
+	}
+
+	// Garbage after the last record is a torn tail as well.
+	tBytes.insert( tBytes.end(), 3, 0 );
+	WriteBytes( tBytes, tBytes.size() );
+	CHECK( ResumeAndCheck( g_nRecords, tEnds[g_nRecords] ) );
+}
+
+static void TestOptions()
+{
+	std::vector<size_t> tEnds;
+	std::vector<BYTE> tBytes;
+
+	// A journal made by a plain run, sorted by name with no /v filter.
+	g_bSortByVersion = FALSE;
+	g_sOlderThan = NULL;
+	tBytes = WriteJournal( &tEnds );
+
+	// The same options resume every host.
+	CHECK( ResumeAndCheck( g_nRecords, tBytes.size() ) );
+
+	// The records stay good but no host is taken from them.
+	g_bSortByVersion = TRUE;
+	WriteBytes( tBytes, tBytes.size() );
+	CHECK( ResumeAndCheck( 0, tBytes.size() ) );
+	g_bSortByVersion = FALSE;
+
+	g_sOlderThan = TEXT("2.0");
+	ParseVersionKey( g_sOlderThan, &g_tOlderThan );
+	WriteBytes( tBytes, tBytes.size() );
+	CHECK( ResumeAndCheck( 0, tBytes.size() ) );
+
+	g_nOutputFormat = OUTPUT_CSV;
+	g_sOlderThan = NULL;
+	WriteBytes( tBytes, tBytes.size() );
+	CHECK( ResumeAndCheck( 0, tBytes.size() ) );
+	g_nOutputFormat = OUTPUT_TEXT;
+
+	// A /v run resumes only from a journal made with the same version.
+	g_sOlderThan = TEXT("2.0");
+	ParseVersionKey( g_sOlderThan, &g_tOlderThan );
+	tBytes = WriteJournal( &tEnds );
+	CHECK( ResumeAndCheck( g_nRecords, tBytes.size() ) );
+
+	g_sOlderThan = TEXT("v2.0.0");
+	ParseVersionKey( g_sOlderThan, &g_tOlderThan );
+	WriteBytes( tBytes, tBytes.size() );
+	CHECK( ResumeAndCheck( g_nRecords, tBytes.size() ) );
+
+	g_sOlderThan = TEXT("2.0 rc1");
+	ParseVersionKey( g_sOlderThan, &g_tOlderThan );
+	WriteBytes( tBytes, tBytes.size() );
+	CHECK( ResumeAndCheck( 0, tBytes.size() ) );
+
+	g_sOlderThan = NULL;
+}
+
+static void TestOversize()
+{
+	std::vector<size_t> tEnds;
+	std::string sLarge( JOURNAL_MAX_OUTPUT + 1, 'x' );
+	std::string sReport = ReportFor( 3 );
+	size_t nSize;
+
+	// One host is journaled, the next has a report too large to read back.
+	SetUpHosts();
+	CHECK( ERROR_SUCCESS == OpenFleetJournal( (const TCHAR*)g_sWidePath.c_str(), FALSE, TRUE ) );
+
+	CHECK( AppendFleetOutput( &g_pFleetHosts[3], (const BYTE*)sReport.data(), (DWORD)sReport.size() ) );
+	AppendJournalRecord( &g_pFleetHosts[3] );
+	nSize = FileSize( g_sPath );
+
+	CHECK( AppendFleetOutput( &g_pFleetHosts[0], (const BYTE*)sLarge.data(), (DWORD)sLarge.size() ) );
+	SilenceStderr();
+	AppendJournalRecord( &g_pFleetHosts[0] );
+	RestoreStderr();
+
+	CloseJournal();
+	TearDownHosts();
+
+	// Nothing was written for it, so a resumed run collects it again.
+	CHECK( FileSize( g_sPath ) == nSize );
+
+	SetUpHosts();
+	SilenceStderr();
+	CHECK( ERROR_SUCCESS == OpenFleetJournal( (const TCHAR*)g_sWidePath.c_str(), TRUE, FALSE ) );
+	RestoreStderr();
+
+	CHECK( g_pFleetHosts[3].Done );
+	CHECK( !g_pFleetHosts[0].Done );
+
+	CloseJournal();
+	TearDownHosts();
+}
+
+static void TestOverwrite()
+{
+	std::vector<size_t> tEnds;
+	std::vector<BYTE> tBytes = WriteJournal( &tEnds );
+	LONG result;
+
+	// A new run leaves a journal with finished hosts alone.
+	SilenceStderr();
+	result = OpenFleetJournal( (const TCHAR*)g_sWidePath.c_str(), FALSE, FALSE );
+	RestoreStderr();
+
+	CHECK( ERROR_FILE_EXISTS == result );
+	CHECK( NULL == g_hJournal );
+	CHECK( FileSize( g_sPath ) == tBytes.size() );
+
+	// Replacing it starts over.
+	CHECK( ERROR_SUCCESS == OpenFleetJournal( (const TCHAR*)g_sWidePath.c_str(), FALSE, TRUE ) );
+	CloseJournal();
+	CHECK( 0 == FileSize( g_sPath ) );
+
+	// An empty journal holds nothing to lose.
+	CHECK( ERROR_SUCCESS == OpenFleetJournal( (const TCHAR*)g_sWidePath.c_str(), FALSE, FALSE ) );
+	CloseJournal();
+}
+
+// Starts ./instsoft with its output and errors sent to files.
+static pid_t StartFleet( const std::vector<std::string>& tArguments, const std::string& sOutput, const std::string& sErrors )
+{
+	std::vector<std::string> tCopy( tArguments );
+	std::vector<char*> tArgv;
+	pid_t nProcess;
+
+	tCopy.insert( tCopy.begin(), "./instsoft" );
+
+	for( size_t i = 0; i < tCopy.size(); i++ ) tArgv.push_back( &tCopy[i][0] );
+	tArgv.push_back( NULL );
+
+	nProcess = fork();
+	if( 0 == nProcess )
+	{
+		dup2( open( sOutput.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 ), 1 );
+		dup2( open( sErrors.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 ), 2 );
+
+		execv( tArgv[0], tArgv.data() );
+		_exit( 127 );
+	}
+
+	return nProcess;
+}
+
+static int RunFleet( const std::vector<std::string>& tArguments, const std::string& sOutput, const std::string& sErrors )
+{
+	pid_t nProcess = StartFleet( tArguments, sOutput, sErrors );
+	int nStatus = -1;
+
+	waitpid( nProcess, &nStatus, 0 );
+
+	return nStatus;
+}
+
+// The number of hosts a run says it resumed, or -1.
+static int ResumedHosts( const std::string& sErrors )
+{
+	std::string sText = ReadText( sErrors );
+	size_t nAt = sText.find( "Resumed " );
+
+	return (std::string::npos == nAt) ? -1 : atoi( sText.c_str() + nAt + 8 );
+}
+
+static void TestKillAndResume()
+{
+	static const char* const sFormats[] = { "text", "csv" };
+	std::string sDirectory = g_sPath.substr( 0, g_sPath.rfind( '/' ) );
+	std::string sHosts = sDirectory + "/hosts.txt";
+	std::string sJournal = sDirectory + "/kill.journal";
+	std::string sExpected = sDirectory + "/expected.out";
+	std::string sOutput = sDirectory + "/fleet.out";
+	std::string sErrors = sDirectory + "/fleet.err";
+	FILE* hFile;
+	pid_t nProcess;
+	int nStatus;
+	int nResumed;
+
+	if( access( "./instsoft", X_OK ) != 0 )
+	{
+		CHECK( !"./instsoft is built" );
+		return;
+	}
+
+	hFile = fopen( sHosts.c_str(), "w" );
+	for( int i = 0; i < FLEET_HOSTS; i++ ) fprintf( hFile, "host%03d\n", i );
+	fclose( hFile );
+
+	for( int nFormat = 0; nFormat < 2; nFormat++ )
+	{
+		std::vector<std::string> tRun;
+
+		tRun.push_back( "/m" ); tRun.push_back( sHosts );
+		tRun.push_back( "/n" ); tRun.push_back( "4" );
+		tRun.push_back( "/x" ); tRun.push_back( "2" );
+		tRun.push_back( "/o" ); tRun.push_back( sFormats[nFormat] );
+
+		// An uninterrupted run without a journal.
+		RunFleet( tRun, sExpected, sErrors );
+		CHECK( ReadText( sExpected ).size() > 0 );
+
+		tRun.push_back( "/j" ); tRun.push_back( sJournal );
+		unlink( sJournal.c_str() );
+
+		// Kill the coordinator once a few dozen hosts are journaled.
+		nProcess = StartFleet( tRun, sOutput, sErrors );
+
+		while( (FileSize( sJournal ) < 64 * 1024) && (0 == waitpid( nProcess, &nStatus, WNOHANG )) ) usleep( 1000 );
+
+		kill( nProcess, SIGKILL );
+		waitpid( nProcess, &nStatus, 0 );
+
+		CHECK( WIFSIGNALED( nStatus ) );
+
+		// Without /r or /c the journal is kept and nothing runs.
+		nStatus = RunFleet( tRun, sOutput, sErrors );
+		CHECK( WIFEXITED( nStatus ) && (0 != WEXITSTATUS( nStatus )) );
+		CHECK( ReadText( sOutput ).empty() );
+		CHECK( FileSize( sJournal ) >= 64 * 1024 );
+
+		// The resumed run collects only the rest, yet writes every report.
+		tRun.push_back( "/r" );
+		RunFleet( tRun, sOutput, sErrors );
+
+		nResumed = ResumedHosts( sErrors );
+		CHECK( (nResumed > 0) && (nResumed < FLEET_HOSTS) );
+		CHECK( ReadText( sOutput ) == ReadText( sExpected ) );
+
+		// Resuming a finished run only collects the hosts that failed.
+		RunFleet( tRun, sOutput, sErrors );
+
+		CHECK( ResumedHosts( sErrors ) > nResumed );
+		CHECK( ReadText( sOutput ) == ReadText( sExpected ) );
+
+		// /c starts the journal over.
+		tRun.back() = "/c";
+		RunFleet( tRun, sOutput, sErrors );
+
+		CHECK( -1 == ResumedHosts( sErrors ) );
+		CHECK( ReadText( sOutput ) == ReadText( sExpected ) );
+	}
+
+	unlink( sHosts.c_str() );
+	unlink( sJournal.c_str() );
+	unlink( sExpected.c_str() );
+	unlink( sOutput.c_str() );
+	unlink( sErrors.c_str() );
+}
+
+int main()
+{
+	char sDirectory[] = "/tmp/journal_testXXXXXX";
+
+	g_hProcessHeap = GetProcessHeap();
+	g_sPath = std::string( mkdtemp( sDirectory ) ) + "/fleet.journal";
+	g_sWidePath = std::u16string( g_sPath.begin(), g_sPath.end() );
+
+	TestTruncation();
+	TestCorruption();
+	TestOptions();
+	TestOversize();
+	TestOverwrite();
+	TestKillAndResume();
+
+	unlink( g_sPath.c_str() );
+	rmdir( sDirectory );
+
+	return ReportChecks( "journal_test" );
+}
@@ -0,0 +1,152 @@
+// ----------------------------------------------------------------------------
+//  File name: schema_test.cpp
+//
+//  Runs the schema-driven extractor over an in-memory registry and checks
+//  that it produces the records the per-value RegQueryValueEx code did:
+//  missing optional values read "N/A", entries without a name are left
+//  out, and Products entries are joined to Uninstall by product code.
+// ----------------------------------------------------------------------------
+#include "check.h"
+#include "../instsoft.cpp"
+
+#define UNINSTALL	TEXT("Software\\Microsoft\\Windows\\CurrentVersion\\Uninstall\\")
+#define PRODUCTS	TEXT("Software\\Classes\\Installer\\Products\\")
+
+struct EXPECTED_RECORD
+{
+	const TCHAR*	DisplayName;
+	const TCHAR*	InstallDate;
+	const TCHAR*	DisplayVersion;
+	const TCHAR*	ProductCode;
+};
+
+static void FillRegistry()
+{
+	static TCHAR sLong[600];
+	static const TCHAR sUnterminated[] = { 'E', 'p', 's', 'i', 'l', 'o', 'n' };
+	static const BYTE pBinary[] = { 1, 2, 3, 4 };
+
+	for( int i = 0; i < 599; i++ ) sLong[i] = TEXT('x');
+
+	ShimRegistryReset();
+
+	ShimRegistrySetString( UNINSTALL TEXT("AlphaApp"), TEXT("DisplayName"), TEXT("Alpha App") );
+	ShimRegistrySetString( UNINSTALL TEXT("AlphaApp"), TEXT("InstallDate"), TEXT("20200101") );
+	ShimRegistrySetString( UNINSTALL TEXT("AlphaApp"), TEXT("DisplayVersion"), TEXT("1.2.3") );
+
+	// Value names are matched without regard to case.
+	ShimRegistrySetString( UNINSTALL TEXT("BetaApp"), TEXT("DISPLAYVERSION"), TEXT("2.0") );
+	ShimRegistrySetString( UNINSTALL TEXT("BetaApp"), TEXT("displayname"), TEXT("Beta") );
+
+	// No display name: not listed.
+	ShimRegistrySetString( UNINSTALL TEXT("NoName"), TEXT("DisplayVersion"), TEXT("3.0") );
+
+	// Names that only share a prefix with a schema value do not match it.
+	ShimRegistrySetString( UNINSTALL TEXT("Decoy"), TEXT("DisplayNameX"), TEXT("Eta") );
+	ShimRegistrySetString( UNINSTALL TEXT("Decoy"), TEXT("DisplayNam"), TEXT("Eta") );
+
+	// DWORD install dates are formatted; unrelated values are ignored.
+	ShimRegistrySetString( UNINSTALL TEXT("DwordDate"), TEXT("Publisher"), TEXT("Someone") );
+	ShimRegistrySetDword( UNINSTALL TEXT("DwordDate"), TEXT("EstimatedSize"), 1024 );
+	ShimRegistrySetDword( UNINSTALL TEXT("DwordDate"), TEXT("InstallDate"), 20210304 );
+	ShimRegistrySetString( UNINSTALL TEXT("DwordDate"), TEXT("DisplayName"), TEXT("Delta") );
+
+	// Strings without a terminator, and values of the wrong type.
+	ShimRegistrySetValue( UNINSTALL TEXT("Unterminated"), TEXT("DisplayName"), REG_SZ, sUnterminated, sizeof(sUnterminated) );
+	ShimRegistrySetValue( UNINSTALL TEXT("Unterminated"), TEXT("DisplayVersion"), REG_BINARY, pBinary, sizeof(pBinary) );
+
+	// Data too large for the value buffer counts as missing.
+	ShimRegistrySetString( UNINSTALL TEXT("Oversized"), TEXT("DisplayName"), sLong );
+	ShimRegistrySetString( UNINSTALL TEXT("OversizedVersion"), TEXT("DisplayName"), TEXT("Zeta") );
+	ShimRegistrySetString( UNINSTALL TEXT("OversizedVersion"), TEXT("DisplayVersion"), sLong );
+
+	// An MSI install whose version only appears under Products.
+	ShimRegistrySetString( UNINSTALL TEXT("{12345678-abcd-ef01-2345-6789abcdef01}"), TEXT("DisplayName"), TEXT("Gamma") );
+	ShimRegistrySetString( PRODUCTS TEXT("87654321DCBA10FE32547698BADCFE10"), TEXT("ProductName"), TEXT("Gamma MSI") );
+	ShimRegistrySetDword( PRODUCTS TEXT("87654321DCBA10FE32547698BADCFE10"), TEXT("Version"), 0x0102000A );
+
+	// Products entries with no Uninstall match are added on their own.
+	ShimRegistrySetString( PRODUCTS TEXT("DDCCBBAA1111222233334444555566F6"), TEXT("ProductName"), TEXT("Theta") );
+	ShimRegistrySetString( PRODUCTS TEXT("NotAGuid"), TEXT("productname"), TEXT("Iota") );
+	ShimRegistrySetDword( PRODUCTS TEXT("NotAGuid"), TEXT("Version"), 0x05000001 );
+}
+
+static void TestCollect()
+{
+	static const EXPECTED_RECORD tExpected[] =
+	{
+		{ TEXT("Alpha App"),	TEXT("20200101"),	TEXT("1.2.3"),	TEXT("") },
+		{ TEXT("Beta"),			TEXT("N/A"),		TEXT("2.0"),	TEXT("") },
+		{ TEXT("Delta"),		TEXT("20210304"),	TEXT("N/A"),	TEXT("") },
+		{ TEXT("Epsilon"),		TEXT("N/A"),		TEXT("N/A"),	TEXT("") },
+		{ TEXT("Gamma"),		TEXT("N/A"),		TEXT("1.2.10"),	TEXT("{12345678-ABCD-EF01-2345-6789ABCDEF01}") },
+		{ TEXT("Iota"),			TEXT("N/A"),		TEXT("5.0.1"),	TEXT("") },
+		{ TEXT("Theta"),		TEXT("N/A"),		TEXT("N/A"),	TEXT("{AABBCCDD-1111-2222-3333-44445555666F}") },
+		{ TEXT("Zeta"),			TEXT("N/A"),		TEXT("N/A"),	TEXT("") },
+	};
+	const DWORD nExpected = sizeof(tExpected) / sizeof(tExpected[0]);
+	PSOFTWARE_DATA_NODE pCurrent;
+	VERSION_KEY tKey;
+	DWORD nCount = 0;
+
+	FillRegistry();
+
+	CHECK( ERROR_SUCCESS == CollectSoftwareLists( TEXT("LOCALHOST"), FALSE ) );
+
+	for( pCurrent = g_pSoftwareListHead; pCurrent; pCurrent = pCurrent->Next, nCount++ )
+	{
+		if( nCount >= nExpected ) break;
+
+		CHECK_TEXT( pCurrent->Data.DisplayName, tExpected[nCount].DisplayName );
+		CHECK_TEXT( pCurrent->Data.InstallDate, tExpected[nCount].InstallDate );
+		CHECK_TEXT( pCurrent->Data.DisplayVersion, tExpected[nCount].DisplayVersion );
+		CHECK_TEXT( pCurrent->Data.ProductCode, tExpected[nCount].ProductCode );
+
+		// The parsed key always follows the version text it came from.
+		ParseVersionKey( tExpected[nCount].DisplayVersion, &tKey );
+		CHECK( CompareVersionKeys( &pCurrent->Data.VersionKey, &tKey ) == 0 );
+	}
+
+	CHECK( nExpected == nCount );
+	CHECK( NULL == pCurrent );
+
+	DestroySoftwareLists();
+}
+
+static void TestDefaults()
+{
+	// Every optional row carries the default that used to be hard coded.
+	for( DWORD i = 0; i < UNINSTALL_SCHEMA::ValueCount; i++ )
+	{
+		const VALUE_SCHEMA& schema = UNINSTALL_SCHEMA::Values[i];
+
+		CHECK( schema.Required == (NULL == schema.Default) );
+	}
+
+	for( DWORD i = 0; i < PRODUCTS_SCHEMA::ValueCount; i++ )
+	{
+		const VALUE_SCHEMA& schema = PRODUCTS_SCHEMA::Values[i];
+
+		CHECK( schema.Required == (NULL == schema.Default) );
+	}
+
+	// An empty registry key gives an empty list, not an error.
+	ShimRegistryReset();
+	ShimRegistrySetString( TEXT("Software\\Microsoft\\Windows\\CurrentVersion\\Uninstall\\Empty"), TEXT("Other"), TEXT("") );
+	ShimRegistrySetString( TEXT("Software\\Classes\\Installer\\Products\\Empty"), TEXT("Other"), TEXT("") );
+
+	CHECK( ERROR_SUCCESS == CollectSoftwareLists( TEXT("LOCALHOST"), FALSE ) );
+	CHECK( NULL == g_pSoftwareListHead );
+
+	DestroySoftwareLists();
+}
+
+int main()
+{
+	g_hProcessHeap = GetProcessHeap();
+
+	TestCollect();
+	TestDefaults();
+
+	return ReportChecks( "schema_test" );
+}
@@ -0,0 +1,121 @@
+// ----------------------------------------------------------------------------
+//  File name: version_bench.cpp
+//
+//  Times ParseVersionKey over the real-world versions in data/versions.txt,
+//  and sorting by parsed keys against parsing inside the comparison, which
+//  is what a sort without keys made at ingest would pay.
+// ----------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "../instsoft.cpp"
+
+#define BENCH_COPIES	1000
+
+typedef std::chrono::steady_clock CLOCK;
+
+static double Seconds( CLOCK::time_point tStart )
+{
+	return std::chrono::duration<double>( CLOCK::now() - tStart ).count();
+}
+
+static bool KeyLess( const VERSION_KEY& tFirst, const VERSION_KEY& tSecond )
+{
+	return CompareVersionKeys( &tFirst, &tSecond ) < 0;
+}
+
+static bool TextLess( const std::u16string& sFirst, const std::u16string& sSecond )
+{
+	VERSION_KEY tFirst, tSecond;
+
+	ParseVersionKey( (const TCHAR*)sFirst.c_str(), &tFirst );
+	ParseVersionKey( (const TCHAR*)sSecond.c_str(), &tSecond );
+
+	return CompareVersionKeys( &tFirst, &tSecond ) < 0;
+}
+
+int main()
+{
+	std::vector<std::u16string> tCorpus, tVersions, tTexts;
+	std::vector<VERSION_KEY> tKeys;
+	FILE* hFile = fopen( "data/versions.txt", "rb" );
+	char sLine[256];
+	CLOCK::time_point tStart;
+	double nBest;
+	DWORD nKnown = 0;
+
+	g_hProcessHeap = GetProcessHeap();
+
+	if( NULL == hFile )
+	{
+		fprintf( stderr, "version_bench: cannot open data/versions.txt\n" );
+		return 1;
+	}
+
+	while( fgets( sLine, sizeof(sLine), hFile ) )
+	{
+		std::u16string sVersion;
+
+		sLine[strcspn( sLine, "\r\n" )] = 0;
+		for( char* p = sLine; *p; p++ ) sVersion += (char16_t)(unsigned char)*p;
+
+		tCorpus.push_back( sVersion );
+	}
+
+	fclose( hFile );
+
+	// Copies of the corpus in a fixed shuffled order.
+	for( int i = 0; i < BENCH_COPIES; i++ ) tVersions.insert( tVersions.end(), tCorpus.begin(), tCorpus.end() );
+
+	srand( 1 );
+	for( size_t i = tVersions.size() - 1; i > 0; i-- ) std::swap( tVersions[i], tVersions[rand() % (i + 1)] );
+
+	tKeys.resize( tVersions.size() );
+
+	// Best of five for each figure.
+	nBest = 1e30;
+
+	for( int nTrial = 0; nTrial < 5; nTrial++ )
+	{
+		tStart = CLOCK::now();
+
+		for( size_t i = 0; i < tVersions.size(); i++ ) ParseVersionKey( (const TCHAR*)tVersions[i].c_str(), &tKeys[i] );
+
+		nBest = min( nBest, Seconds( tStart ) );
+	}
+
+	for( size_t i = 0; i < tKeys.size(); i++ ) nKnown += IsVersionKnown( &tKeys[i] );
+
+	printf( "parse:       %8.1f ns/version over %u versions (%u known, %u distinct)\n",
+			nBest * 1e9 / tVersions.size(), (DWORD)tVersions.size(), nKnown, (DWORD)tCorpus.size() );
+
+	nBest = 1e30;
+
+	for( int nTrial = 0; nTrial < 5; nTrial++ )
+	{
+		std::vector<VERSION_KEY> tSorted( tKeys );
+
+		tStart = CLOCK::now();
+		std::stable_sort( tSorted.begin(), tSorted.end(), KeyLess );
+		nBest = min( nBest, Seconds( tStart ) );
+	}
+
+	printf( "sort keys:   %8.1f ms\n", nBest * 1e3 );
+
+	nBest = 1e30;
+
+	for( int nTrial = 0; nTrial < 5; nTrial++ )
+	{
+		tTexts = tVersions;
+
+		tStart = CLOCK::now();
+		std::stable_sort( tTexts.begin(), tTexts.end(), TextLess );
+		nBest = min( nBest, Seconds( tStart ) );
+	}
+
+	printf( "sort text:   %8.1f ms (parsing in the comparison)\n", nBest * 1e3 );
+
+	return 0;
+}
@@ -0,0 +1,250 @@
+// ----------------------------------------------------------------------------
+//  File name: version_test.cpp
+//
+//  Checks the ordering ParseVersionKey gives: numeric components compare by
+//  value, the pre-release tags dev, alpha, beta, pre, preview and rc sort
+//  below the bare version, and any other suffix sorts at or above it.
+// ----------------------------------------------------------------------------
+#include <vector>
+
+#include "check.h"
+#include "../instsoft.cpp"
+
+static std::u16string Widen( const char* s )
+{
+	std::u16string sWide;
+
+	for( ; *s; s++ ) sWide += (char16_t)(unsigned char)*s;
+
+	return sWide;
+}
+
+static int Compare( const char* sFirst, const char* sSecond )
+{
+	VERSION_KEY tFirst, tSecond;
+
+	ParseVersionKey( (const TCHAR*)Widen( sFirst ).c_str(), &tFirst );
+	ParseVersionKey( (const TCHAR*)Widen( sSecond ).c_str(), &tSecond );
+
+	return CompareVersionKeys( &tFirst, &tSecond );
+}
+
+#define CHECK_ORDER( first, op, second ) \
+	do \
+	{ \
+		g_nChecks++; \
+		if( !(Compare( first, second ) op 0) ) \
+		{ \
+			g_nFailures++; \
+			fprintf( stderr, "%s:%d: expected \"%s\" %s \"%s\"\n", __FILE__, __LINE__, first, #op, second ); \
+		} \
+	} while( 0 )
+
+static void TestAscending()
+{
+	// Each entry is strictly newer than the one before it.
+	static const char* const sVersions[] =
+	{
+		"0.9",
+		"1.0 dev",
+		"1.0-dev2",
+		"1.0 alpha",
+		"1.0-alpha1",
+		"1.0-alpha2",
+		"1.0-alpha10",
+		"1.0beta",
+		"1.0 Beta 2",
+		"1.0 pre",
+		"1.0-preview.3",
+		"1.0 RC1",
+		"1.0rc2",
+		"1.0-rc10",
+		"1.0",
+		"1.0a",
+		"1.0b",
+		"1.0 SP1",
+		"1.0 SP2",
+		"1.0 SP10",
+		"1.0.1",
+		"1.2.3",
+		"1.2.3 (x64)",
+		"1.2.4",
+		"1.10",
+		"2.0 alpha",
+		"2.0",
+		"v2.0.1",
+		"10.0.22621.2428",
+		"10.1",
+	};
+	const int nVersions = sizeof(sVersions) / sizeof(sVersions[0]);
+
+	// Every pair, not just neighbours, so the order is transitive.
+	for( int i = 0; i < nVersions; i++ )
+	{
+		for( int j = 0; j < nVersions; j++ )
+		{
+			if( i < j ) CHECK_ORDER( sVersions[i], <, sVersions[j] );
+			else if( i > j ) CHECK_ORDER( sVersions[i], >, sVersions[j] );
+			else CHECK_ORDER( sVersions[i], ==, sVersions[j] );
+		}
+	}
+}
+
+static void TestSuffixes()
+{
+	// The cases that used to sort below the bare version.
+	CHECK_ORDER( "1.0 SP1", >, "1.0" );
+	CHECK_ORDER( "1.0a", >, "1.0" );
+	CHECK_ORDER( "1.2.3 (x64)", >=, "1.2.3" );
+	CHECK_ORDER( "1.2.3 (x64)", <, "1.2.4" );
+	CHECK_ORDER( "6.1.7601 Service Pack 1", >, "6.1.7601" );
+	CHECK_ORDER( "1.2.3 Update 5", >, "1.2.3 Update 4" );
+
+	// Numeric runs in a suffix compare by value.
+	CHECK_ORDER( "1.0 alpha10", >, "1.0 alpha2" );
+	CHECK_ORDER( "1.0 rc10", >, "1.0 rc9" );
+	CHECK_ORDER( "9.0 SP10", >, "9.0 SP9" );
+	CHECK_ORDER( "1.2.3-hotfix12", >, "1.2.3-hotfix3" );
+	CHECK_ORDER( "1.0 SP01", ==, "1.0 SP1" );
+	CHECK_ORDER( "1.0 build 112", >, "1.0 build 111" );
+	CHECK_ORDER( "1.0 build 1000", >, "1.0 build 255" );
+	CHECK_ORDER( "1.0 build 256", >, "1.0 build 255" );
+	CHECK_ORDER( "1.0 build 70000", >, "1.0 build 65535" );
+	CHECK_ORDER( "1.0 build 111", >, "1.0 build z" );
+
+	// Tags are case-blind and ignore separators around their number.
+	CHECK_ORDER( "1.0-RC1", ==, "1.0 rc 1" );
+	CHECK_ORDER( "1.0.rc.1", ==, "1.0rc1" );
+	CHECK_ORDER( "1.0 Preview", ==, "1.0 pre" );
+	CHECK_ORDER( "1.0 (SP 1)", ==, "1.0-sp1" );
+
+	// Whole words only: these are not pre-release tags.
+	CHECK_ORDER( "1.0 devices", >, "1.0" );
+	CHECK_ORDER( "1.0 prefix", >, "1.0" );
+	CHECK_ORDER( "1.0 rcx", >, "1.0" );
+	CHECK_ORDER( "1.0 betamax", >, "1.0" );
+
+	// Pre-releases never reach the previous or next release.
+	CHECK_ORDER( "2.0 dev", >, "1.9.9" );
+	CHECK_ORDER( "1.0 SP9", <, "1.0.1 alpha" );
+
+	// The bare version, a leading "v" and leading spaces all match.
+	CHECK_ORDER( "v1.2.3", ==, "1.2.3" );
+	CHECK_ORDER( " 1.2.3", ==, "1.2.3" );
+	CHECK_ORDER( "1.2.3.0", ==, "1.2.3" );
+}
+
+static void TestUnknown()
+{
+	VERSION_KEY tKey;
+
+	ParseVersionKey( TEXT("N/A"), &tKey );
+	CHECK( !IsVersionKnown( &tKey ) );
+
+	ParseVersionKey( TEXT(""), &tKey );
+	CHECK( !IsVersionKnown( &tKey ) );
+
+	ParseVersionKey( TEXT("   "), &tKey );
+	CHECK( !IsVersionKnown( &tKey ) );
+
+	ParseVersionKey( TEXT("0"), &tKey );
+	CHECK( IsVersionKnown( &tKey ) );
+
+	// Text with no version number is as unknown as "N/A".
+	ParseVersionKey( TEXT("beta"), &tKey );
+	CHECK( !IsVersionKnown( &tKey ) );
+
+	ParseVersionKey( TEXT("Unknown"), &tKey );
+	CHECK( !IsVersionKnown( &tKey ) );
+
+	ParseVersionKey( TEXT("latest"), &tKey );
+	CHECK( !IsVersionKnown( &tKey ) );
+
+	ParseVersionKey( TEXT("v"), &tKey );
+	CHECK( !IsVersionKnown( &tKey ) );
+
+	CHECK_ORDER( "N/A", <, "0" );
+	CHECK_ORDER( "N/A", <, "0 dev" );
+	CHECK_ORDER( "Unknown", ==, "N/A" );
+}
+
+static void TestFilter()
+{
+	static const char* const sVersions[] = { "Unknown", "1.0", "latest", "2.5", "N/A", "beta", "1.9 SP1" };
+	PSOFTWARE_DATA_NODE pNode;
+	VERSION_KEY tLimit;
+	DWORD nKept = 0;
+
+	for( DWORD i = 0; i < sizeof(sVersions) / sizeof(sVersions[0]); i++ )
+	{
+		pNode = (PSOFTWARE_DATA_NODE)HeapAlloc( g_hProcessHeap, HEAP_ZERO_MEMORY, sizeof(SOFTWARE_DATA_NODE) );
+
+		StringCchPrintf( pNode->Data.DisplayName, DISPLAY_NAME_LENGTH, TEXT("App %u"), i );
+		StringCchCopy( pNode->Data.DisplayVersion, VERSION_LENGTH, (const TCHAR*)Widen( sVersions[i] ).c_str() );
+		ParseVersionKey( pNode->Data.DisplayVersion, &pNode->Data.VersionKey );
+
+		AddNodeToList( pNode );
+	}
+
+	// Only versions that really are older than 2.0 are reported.
+	ParseVersionKey( TEXT("2.0"), &tLimit );
+	FilterSoftwareListOlderThan( &tLimit );
+
+	for( pNode = g_pSoftwareListHead; pNode; pNode = pNode->Next, nKept++ )
+	{
+		CHECK( (CompareStringOrdinal( pNode->Data.DisplayVersion, -1, TEXT("1.0"), -1, FALSE ) == CSTR_EQUAL) ||
+			   (CompareStringOrdinal( pNode->Data.DisplayVersion, -1, TEXT("1.9 SP1"), -1, FALSE ) == CSTR_EQUAL) );
+	}
+
+	CHECK( 2 == nKept );
+
+	DestroySoftwareLists();
+}
+
+static void TestCorpus()
+{
+	std::vector<std::u16string> tLines;
+	FILE* hFile = fopen( "data/versions.txt", "rb" );
+	char sLine[256];
+	VERSION_KEY tKey, tSuffixed;
+
+	CHECK( NULL != hFile );
+	if( NULL == hFile ) return;
+
+	while( fgets( sLine, sizeof(sLine), hFile ) )
+	{
+		sLine[strcspn( sLine, "\r\n" )] = 0;
+		tLines.push_back( Widen( sLine ) );
+	}
+
+	fclose( hFile );
+
+	CHECK( tLines.size() > 100 );
+
+	for( size_t i = 0; i < tLines.size(); i++ )
+	{
+		std::u16string sVersion = tLines[i];
+
+		ParseVersionKey( (const TCHAR*)sVersion.c_str(), &tKey );
+		CHECK( IsVersionKnown( &tKey ) == (sVersion != u"N/A") );
+
+		if( !IsVersionKnown( &tKey ) ) continue;
+
+		// An architecture note never makes a version look older.
+		ParseVersionKey( (const TCHAR*)(sVersion + u" (x64)").c_str(), &tSuffixed );
+		CHECK( CompareVersionKeys( &tSuffixed, &tKey ) >= 0 );
+	}
+}
+
+int main()
+{
+	g_hProcessHeap = GetProcessHeap();
+
+	TestAscending();
+	TestSuffixes();
+	TestUnknown();
+	TestFilter();
+	TestCorpus();
+
+	return ReportChecks( "version_test" );
+}
@@ -0,0 +1,243 @@
+// ----------------------------------------------------------------------------
+//  File name: Windows.h
+//
+//  Minimal stand-in for the Windows SDK so instsoft.cpp can be compiled and
+//  unit tested on Linux. Built with -fshort-wchar so TCHAR is UTF-16 as in
+//  the UNICODE build. Only what instsoft.cpp uses is declared here; the
+//  implementations are in shim.cpp.
+// ----------------------------------------------------------------------------
+#ifndef INSTSOFT_TEST_WINDOWS_H
+#define INSTSOFT_TEST_WINDOWS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef UNICODE
+#define UNICODE
+#endif
+
+typedef wchar_t				WCHAR, TCHAR, *PTCHAR, *LPWSTR, *LPTSTR;
+typedef const wchar_t		*LPCWSTR, *LPCTSTR;
+typedef char				CHAR, *LPSTR;
+typedef const char*			LPCSTR;
+typedef uint8_t				BYTE, *PBYTE, *LPBYTE;
+typedef uint16_t			WORD;
+typedef uint32_t			DWORD, *PDWORD, *LPDWORD, UINT;
+typedef int32_t				LONG, *PLONG, BOOL;
+typedef uint64_t			ULONGLONG, DWORD64;
+typedef int64_t				LONGLONG;
+typedef size_t				SIZE_T, ULONG_PTR, DWORD_PTR;
+typedef void				*HANDLE, *LPVOID, *PVOID;
+typedef const void*			LPCVOID;
+typedef struct SHIM_KEY*	HKEY;
+typedef HKEY*				PHKEY;
+
+typedef union _LARGE_INTEGER
+{
+	struct { DWORD LowPart; LONG HighPart; };
+	LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef struct _SECURITY_ATTRIBUTES
+{
+	DWORD	nLength;
+	LPVOID	lpSecurityDescriptor;
+	BOOL	bInheritHandle;
+} SECURITY_ATTRIBUTES, *LPSECURITY_ATTRIBUTES;
+
+typedef struct _STARTUPINFO
+{
+	DWORD	cb;
+	DWORD	dwFlags;
+	HANDLE	hStdInput;
+	HANDLE	hStdOutput;
+	HANDLE	hStdError;
+} STARTUPINFO;
+
+typedef struct _PROCESS_INFORMATION
+{
+	HANDLE	hProcess;
+	HANDLE	hThread;
+	DWORD	dwProcessId;
+	DWORD	dwThreadId;
+} PROCESS_INFORMATION;
+
+typedef struct _SYSTEMTIME
+{
+	WORD wYear, wMonth, wDayOfWeek, wDay, wHour, wMinute, wSecond, wMilliseconds;
+} SYSTEMTIME;
+
+typedef struct _WIN32_FIND_DATA
+{
+	DWORD	dwFileAttributes;
+	TCHAR	cFileName[260];
+} WIN32_FIND_DATA;
+
+typedef struct _SYSTEM_INFO
+{
+	DWORD	dwNumberOfProcessors;
+} SYSTEM_INFO;
+
+typedef struct _CRITICAL_SECTION
+{
+	void*	Mutex;
+} CRITICAL_SECTION, *LPCRITICAL_SECTION;
+
+typedef DWORD (*LPTHREAD_START_ROUTINE)( LPVOID );
+
+#define WINAPI
+#define TRUE	1
+#define FALSE	0
+#define MAX_PATH	260
+
+#define __TEXT(x)	L##x
+#define TEXT(x)		__TEXT(x)
+
+#define ERROR_SUCCESS				0
+#define ERROR_INVALID_FUNCTION		1
+#define ERROR_FILE_NOT_FOUND		2
+#define ERROR_ACCESS_DENIED			5
+#define ERROR_NOT_ENOUGH_MEMORY		8
+#define ERROR_INVALID_DATA			13
+#define ERROR_OUTOFMEMORY			14
+#define ERROR_HANDLE_EOF			38
+#define ERROR_FILE_EXISTS			80
+#define ERROR_INVALID_PARAMETER		87
+#define ERROR_BROKEN_PIPE			109
+#define ERROR_INSUFFICIENT_BUFFER	122
+#define ERROR_MORE_DATA				234
+#define ERROR_NO_MORE_ITEMS			259
+
+#define HEAP_ZERO_MEMORY			0x00000008
+#define KEY_READ					0x20019
+#define REG_SZ						1
+#define REG_EXPAND_SZ				2
+#define REG_BINARY					3
+#define REG_DWORD					4
+#define HKEY_LOCAL_MACHINE			((HKEY)(ULONG_PTR)0x80000002)
+
+#define LOCALE_USER_DEFAULT			0x0400
+#define NORM_IGNORECASE				0x00000001
+#define CSTR_LESS_THAN				1
+#define CSTR_EQUAL					2
+#define CSTR_GREATER_THAN			3
+#define TIME_FORCE24HOURFORMAT		0x00000008
+#define CP_ACP						0
+#define CP_UTF8						65001
+
+#define INVALID_HANDLE_VALUE		((HANDLE)(LONG_PTR_SHIM)-1)
+typedef intptr_t					LONG_PTR_SHIM;
+#define INFINITE					0xFFFFFFFF
+#define WAIT_OBJECT_0				0
+#define WAIT_FAILED					0xFFFFFFFF
+#define MAXIMUM_WAIT_OBJECTS		64
+
+#define GENERIC_READ				0x80000000
+#define GENERIC_WRITE				0x40000000
+#define FILE_SHARE_READ				0x00000001
+#define FILE_SHARE_WRITE			0x00000002
+#define CREATE_ALWAYS				2
+#define OPEN_EXISTING				3
+#define OPEN_ALWAYS					4
+#define FILE_ATTRIBUTE_DIRECTORY	0x00000010
+#define FILE_ATTRIBUTE_NORMAL		0x00000080
+#define FILE_FLAG_WRITE_THROUGH		0x80000000
+#define FILE_FLAG_SEQUENTIAL_SCAN	0x08000000
+#define FILE_BEGIN					0
+#define FILE_CURRENT				1
+#define FILE_END					2
+#define PAGE_READONLY				0x02
+#define FILE_MAP_READ				0x0004
+
+#define STARTF_USESTDHANDLES		0x00000100
+#define HANDLE_FLAG_INHERIT			0x00000001
+#define CREATE_NO_WINDOW			0x08000000
+#define STD_INPUT_HANDLE			((DWORD)-10)
+#define STD_OUTPUT_HANDLE			((DWORD)-11)
+#define STD_ERROR_HANDLE			((DWORD)-12)
+#define PF_XMMI64_INSTRUCTIONS_AVAILABLE	10
+
+#define CopyMemory( d, s, n )	memcpy( (d), (s), (n) )
+#define MoveMemory( d, s, n )	memmove( (d), (s), (n) )
+#define ZeroMemory( d, n )		memset( (d), 0, (n) )
+
+#ifndef min
+#define min( a, b )	(((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max( a, b )	(((a) > (b)) ? (a) : (b))
+#endif
+
+HANDLE	GetProcessHeap();
+LPVOID	HeapAlloc( HANDLE hHeap, DWORD dwFlags, SIZE_T dwBytes );
+LPVOID	HeapReAlloc( HANDLE hHeap, DWORD dwFlags, LPVOID lpMem, SIZE_T dwBytes );
+BOOL	HeapFree( HANDLE hHeap, DWORD dwFlags, LPVOID lpMem );
+
+int		CompareString( DWORD Locale, DWORD dwCmpFlags, LPCTSTR lpString1, int cchCount1, LPCTSTR lpString2, int cchCount2 );
+int		CompareStringOrdinal( LPCWSTR lpString1, int cchCount1, LPCWSTR lpString2, int cchCount2, BOOL bIgnoreCase );
+DWORD	CharUpperBuff( LPTSTR lpsz, DWORD cchLength );
+int		lstrlenA( LPCSTR lpString );
+int		lstrlenW( LPCWSTR lpString );
+int		lstrlen( LPCTSTR lpString );
+int		WideCharToMultiByte( UINT CodePage, DWORD dwFlags, LPCWSTR lpWideCharStr, int cchWideChar, LPSTR lpMultiByteStr, int cbMultiByte, LPCSTR lpDefaultChar, BOOL* lpUsedDefaultChar );
+int		MultiByteToWideChar( UINT CodePage, DWORD dwFlags, LPCSTR lpMultiByteStr, int cbMultiByte, LPWSTR lpWideCharStr, int cchWideChar );
+
+LONG	RegOpenKeyEx( HKEY hKey, LPCTSTR lpSubKey, DWORD ulOptions, DWORD samDesired, PHKEY phkResult );
+LONG	RegCloseKey( HKEY hKey );
+LONG	RegConnectRegistry( LPCTSTR lpMachineName, HKEY hKey, PHKEY phkResult );
+LONG	RegQueryInfoKey( HKEY hKey, LPTSTR lpClass, LPDWORD lpcClass, LPDWORD lpReserved, LPDWORD lpcSubKeys, LPDWORD lpcMaxSubKeyLen, LPDWORD lpcMaxClassLen, LPDWORD lpcValues, LPDWORD lpcMaxValueNameLen, LPDWORD lpcMaxValueLen, LPDWORD lpcbSecurityDescriptor, LPVOID lpftLastWriteTime );
+LONG	RegEnumKeyEx( HKEY hKey, DWORD dwIndex, LPTSTR lpName, LPDWORD lpcName, LPDWORD lpReserved, LPTSTR lpClass, LPDWORD lpcClass, LPVOID lpftLastWriteTime );
+LONG	RegEnumValue( HKEY hKey, DWORD dwIndex, LPTSTR lpValueName, LPDWORD lpcValueName, LPDWORD lpReserved, LPDWORD lpType, LPBYTE lpData, LPDWORD lpcbData );
+
+DWORD	GetLastError();
+BOOL	CloseHandle( HANDLE hObject );
+HANDLE	CreateFile( LPCTSTR lpFileName, DWORD dwDesiredAccess, DWORD dwShareMode, LPSECURITY_ATTRIBUTES lpSecurityAttributes, DWORD dwCreationDisposition, DWORD dwFlagsAndAttributes, HANDLE hTemplateFile );
+BOOL	ReadFile( HANDLE hFile, LPVOID lpBuffer, DWORD nNumberOfBytesToRead, LPDWORD lpNumberOfBytesRead, LPVOID lpOverlapped );
+BOOL	WriteFile( HANDLE hFile, LPCVOID lpBuffer, DWORD nNumberOfBytesToWrite, LPDWORD lpNumberOfBytesWritten, LPVOID lpOverlapped );
+BOOL	GetFileSizeEx( HANDLE hFile, LARGE_INTEGER* lpFileSize );
+BOOL	SetFilePointerEx( HANDLE hFile, LARGE_INTEGER liDistanceToMove, LARGE_INTEGER* lpNewFilePointer, DWORD dwMoveMethod );
+BOOL	SetEndOfFile( HANDLE hFile );
+BOOL	FlushFileBuffers( HANDLE hFile );
+HANDLE	CreateFileMapping( HANDLE hFile, LPSECURITY_ATTRIBUTES lpAttributes, DWORD flProtect, DWORD dwMaximumSizeHigh, DWORD dwMaximumSizeLow, LPCTSTR lpName );
+LPVOID	MapViewOfFile( HANDLE hFileMappingObject, DWORD dwDesiredAccess, DWORD dwFileOffsetHigh, DWORD dwFileOffsetLow, SIZE_T dwNumberOfBytesToMap );
+BOOL	UnmapViewOfFile( LPCVOID lpBaseAddress );
+HANDLE	FindFirstFile( LPCTSTR lpFileName, WIN32_FIND_DATA* lpFindFileData );
+BOOL	FindNextFile( HANDLE hFindFile, WIN32_FIND_DATA* lpFindFileData );
+BOOL	FindClose( HANDLE hFindFile );
+HANDLE	GetStdHandle( DWORD nStdHandle );
+
+HANDLE	CreateThread( LPSECURITY_ATTRIBUTES lpThreadAttributes, SIZE_T dwStackSize, LPTHREAD_START_ROUTINE lpStartAddress, LPVOID lpParameter, DWORD dwCreationFlags, LPDWORD lpThreadId );
+DWORD	WaitForSingleObject( HANDLE hHandle, DWORD dwMilliseconds );
+DWORD	WaitForMultipleObjects( DWORD nCount, const HANDLE* lpHandles, BOOL bWaitAll, DWORD dwMilliseconds );
+void	Sleep( DWORD dwMilliseconds );
+void	InitializeCriticalSection( LPCRITICAL_SECTION lpCriticalSection );
+void	DeleteCriticalSection( LPCRITICAL_SECTION lpCriticalSection );
+void	EnterCriticalSection( LPCRITICAL_SECTION lpCriticalSection );
+void	LeaveCriticalSection( LPCRITICAL_SECTION lpCriticalSection );
+LONG	InterlockedIncrement( LONG volatile* Addend );
+LONG	InterlockedExchangeAdd( LONG volatile* Addend, LONG Value );
+
+BOOL	CreatePipe( HANDLE* hReadPipe, HANDLE* hWritePipe, LPSECURITY_ATTRIBUTES lpPipeAttributes, DWORD nSize );
+BOOL	SetHandleInformation( HANDLE hObject, DWORD dwMask, DWORD dwFlags );
+BOOL	CreateProcess( LPCTSTR lpApplicationName, LPTSTR lpCommandLine, LPSECURITY_ATTRIBUTES lpProcessAttributes, LPSECURITY_ATTRIBUTES lpThreadAttributes, BOOL bInheritHandles, DWORD dwCreationFlags, LPVOID lpEnvironment, LPCTSTR lpCurrentDirectory, STARTUPINFO* lpStartupInfo, PROCESS_INFORMATION* lpProcessInformation );
+DWORD	GetModuleFileName( LPVOID hModule, LPTSTR lpFilename, DWORD nSize );
+
+void	GetSystemInfo( SYSTEM_INFO* lpSystemInfo );
+BOOL	IsProcessorFeaturePresent( DWORD ProcessorFeature );
+BOOL	GetComputerName( LPTSTR lpBuffer, LPDWORD nSize );
+void	GetLocalTime( SYSTEMTIME* lpSystemTime );
+int		GetTimeFormat( DWORD Locale, DWORD dwFlags, const SYSTEMTIME* lpTime, LPCTSTR lpFormat, LPTSTR lpTimeStr, int cchTime );
+int		GetDateFormat( DWORD Locale, DWORD dwFlags, const SYSTEMTIME* lpDate, LPCTSTR lpFormat, LPTSTR lpDateStr, int cchDate );
+
+// Test hooks for the in-memory registry and the processor.
+void	ShimRegistryReset();
+void	ShimRegistrySetValue( LPCTSTR sKeyPath, LPCTSTR sValueName, DWORD nType, const void* pData, DWORD nSize );
+void	ShimRegistrySetString( LPCTSTR sKeyPath, LPCTSTR sValueName, LPCTSTR sValue );
+void	ShimRegistrySetDword( LPCTSTR sKeyPath, LPCTSTR sValueName, DWORD nValue );
+void	ShimSetSse2( BOOL bPresent );
+void	ShimSetProcessorCount( DWORD nProcessors );
+
+#endif
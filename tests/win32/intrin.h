@@ -0,0 +1,17 @@
+// ----------------------------------------------------------------------------
+//  File name: intrin.h
+//
+//  The compiler intrinsics used by instsoft.cpp, for the Linux test build.
+// ----------------------------------------------------------------------------
+#ifndef INSTSOFT_TEST_INTRIN_H
+#define INSTSOFT_TEST_INTRIN_H
+
+static inline unsigned char _BitScanForward( unsigned long* pIndex, unsigned long nMask )
+{
+	// MSVC leaves *pIndex undefined for a zero mask; zero it here.
+	*pIndex = nMask ? (unsigned long)__builtin_ctzl( nMask ) : 0;
+
+	return nMask ? 1 : 0;
+}
+
+#endif
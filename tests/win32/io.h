@@ -0,0 +1,18 @@
+// ----------------------------------------------------------------------------
+//  File name: io.h
+//
+//  Low-level I/O declarations for the Linux test build.
+// ----------------------------------------------------------------------------
+#ifndef INSTSOFT_TEST_IO_H
+#define INSTSOFT_TEST_IO_H
+
+#include <stdio.h>
+
+#define _O_TEXT		0x4000
+#define _O_BINARY	0x8000
+
+#define _fileno	fileno
+
+int	_setmode( int nHandle, int nMode );
+
+#endif
@@ -0,0 +1,1383 @@
+// ----------------------------------------------------------------------------
+//  File name: shim.cpp
+//
+//  Linux implementations of the Windows functions instsoft.cpp calls, so
+//  its logic can be unit tested. The registry is an in-memory tree filled
+//  in by the tests and remote registries always fail. Worker processes are
+//  real: CreateProcess forks and runs the command line's program with the
+//  given pipes as its standard handles.
+// ----------------------------------------------------------------------------
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// The C++ headers come first so the min and max macros do not reach them.
+#include "Windows.h"
+#include "tchar.h"
+#include "strsafe.h"
+#include "io.h"
+
+
+// ----------------------------------------------------------------------------
+//  Strings.
+// ----------------------------------------------------------------------------
+typedef std::u16string	WIDE_STRING;
+
+static WIDE_STRING Widen( const wchar_t* s )
+{
+	return WIDE_STRING( (const char16_t*)s );
+}
+
+static wchar_t FoldCase( wchar_t c )
+{
+	if( (c >= L'a') && (c <= L'z') ) return (wchar_t)(c - L'a' + L'A');
+
+	return c;
+}
+
+static std::string ToUtf8( const wchar_t* s, int n )
+{
+	std::string sResult;
+
+	for( int i = 0; (n < 0) ? (0 != s[i]) : (i < n); i++ )
+	{
+		DWORD c = (uint16_t)s[i];
+
+		if( (c >= 0xD800) && (c <= 0xDBFF) && (((n < 0) && s[i + 1]) || (i + 1 < n)) &&
+			((uint16_t)s[i + 1] >= 0xDC00) && ((uint16_t)s[i + 1] <= 0xDFFF) )
+		{
+			c = 0x10000 + ((c - 0xD800) << 10) + ((uint16_t)s[++i] - 0xDC00);
+		}
+		else if( (c >= 0xD800) && (c <= 0xDFFF) )
+		{
+			c = 0xFFFD;
+		}
+
+		if( c < 0x80 )
+		{
+			sResult += (char)c;
+		}
+		else if( c < 0x800 )
+		{
+			sResult += (char)(0xC0 | (c >> 6));
+			sResult += (char)(0x80 | (c & 0x3F));
+		}
+		else if( c < 0x10000 )
+		{
+			sResult += (char)(0xE0 | (c >> 12));
+			sResult += (char)(0x80 | ((c >> 6) & 0x3F));
+			sResult += (char)(0x80 | (c & 0x3F));
+		}
+		else
+		{
+			sResult += (char)(0xF0 | (c >> 18));
+			sResult += (char)(0x80 | ((c >> 12) & 0x3F));
+			sResult += (char)(0x80 | ((c >> 6) & 0x3F));
+			sResult += (char)(0x80 | (c & 0x3F));
+		}
+	}
+
+	return sResult;
+}
+
+size_t _tcslen( const wchar_t* s )
+{
+	size_t n = 0;
+
+	while( s[n] ) n++;
+
+	return n;
+}
+
+int _tcscmp( const wchar_t* a, const wchar_t* b )
+{
+	while( *a && (*a == *b) )
+	{
+		a++;
+		b++;
+	}
+
+	return (int)(uint16_t)*a - (int)(uint16_t)*b;
+}
+
+const wchar_t* _tcsrchr( const wchar_t* s, wchar_t c )
+{
+	const wchar_t* pLast = NULL;
+
+	for( ; *s; s++ )
+	{
+		if( *s == c ) pLast = s;
+	}
+
+	return pLast;
+}
+
+unsigned long _tcstoul( const wchar_t* s, wchar_t** pEnd, int nBase )
+{
+	std::string sNarrow = ToUtf8( s, -1 );
+	char* pNarrowEnd;
+	unsigned long nValue = strtoul( sNarrow.c_str(), &pNarrowEnd, nBase );
+
+	if( pEnd ) *pEnd = (wchar_t*)s + (pNarrowEnd - sNarrow.c_str());
+
+	return nValue;
+}
+
+int _istspace( wchar_t c )
+{
+	return (L' ' == c) || ((c >= L'\t') && (c <= L'\r'));
+}
+
+int lstrlenA( LPCSTR lpString )
+{
+	return (int)strlen( lpString );
+}
+
+int lstrlenW( LPCWSTR lpString )
+{
+	return (int)_tcslen( lpString );
+}
+
+int lstrlen( LPCTSTR lpString )
+{
+	return (int)_tcslen( lpString );
+}
+
+static int CompareCounted( const wchar_t* a, int na, const wchar_t* b, int nb, BOOL bIgnoreCase )
+{
+	if( na < 0 ) na = (int)_tcslen( a );
+	if( nb < 0 ) nb = (int)_tcslen( b );
+
+	for( int i = 0; (i < na) && (i < nb); i++ )
+	{
+		uint16_t ca = (uint16_t)(bIgnoreCase ? FoldCase( a[i] ) : a[i]);
+		uint16_t cb = (uint16_t)(bIgnoreCase ? FoldCase( b[i] ) : b[i]);
+
+		if( ca != cb ) return (ca < cb) ? CSTR_LESS_THAN : CSTR_GREATER_THAN;
+	}
+
+	if( na == nb ) return CSTR_EQUAL;
+
+	return (na < nb) ? CSTR_LESS_THAN : CSTR_GREATER_THAN;
+}
+
+int CompareString( DWORD Locale, DWORD dwCmpFlags, LPCTSTR lpString1, int cchCount1, LPCTSTR lpString2, int cchCount2 )
+{
+	// Counted lengths stop at a terminator, as the real function does.
+	if( cchCount1 >= 0 ) for( int i = 0; i < cchCount1; i++ ) if( !lpString1[i] ) { cchCount1 = i; break; }
+	if( cchCount2 >= 0 ) for( int i = 0; i < cchCount2; i++ ) if( !lpString2[i] ) { cchCount2 = i; break; }
+
+	return CompareCounted( lpString1, cchCount1, lpString2, cchCount2, (dwCmpFlags & NORM_IGNORECASE) != 0 );
+}
+
+int CompareStringOrdinal( LPCWSTR lpString1, int cchCount1, LPCWSTR lpString2, int cchCount2, BOOL bIgnoreCase )
+{
+	return CompareCounted( lpString1, cchCount1, lpString2, cchCount2, bIgnoreCase );
+}
+
+DWORD CharUpperBuff( LPTSTR lpsz, DWORD cchLength )
+{
+	for( DWORD i = 0; i < cchLength; i++ ) lpsz[i] = FoldCase( lpsz[i] );
+
+	return cchLength;
+}
+
+int WideCharToMultiByte( UINT CodePage, DWORD dwFlags, LPCWSTR lpWideCharStr, int cchWideChar, LPSTR lpMultiByteStr, int cbMultiByte, LPCSTR lpDefaultChar, BOOL* lpUsedDefaultChar )
+{
+	std::string s = ToUtf8( lpWideCharStr, cchWideChar );
+
+	// A -1 length converts the terminator too.
+	if( cchWideChar < 0 ) s += '\0';
+
+	if( 0 == cbMultiByte ) return (int)s.size();
+	if( (int)s.size() > cbMultiByte ) return 0;
+
+	memcpy( lpMultiByteStr, s.data(), s.size() );
+
+	return (int)s.size();
+}
+
+int MultiByteToWideChar( UINT CodePage, DWORD dwFlags, LPCSTR lpMultiByteStr, int cbMultiByte, LPWSTR lpWideCharStr, int cchWideChar )
+{
+	// The test code page is Latin-1: one byte is one character.
+	int n = (cbMultiByte < 0) ? (int)strlen( lpMultiByteStr ) + 1 : cbMultiByte;
+
+	if( 0 == cchWideChar ) return n;
+	if( n > cchWideChar ) return 0;
+
+	for( int i = 0; i < n; i++ ) lpWideCharStr[i] = (wchar_t)(uint8_t)lpMultiByteStr[i];
+
+	return n;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Formatting.
+// ----------------------------------------------------------------------------
+template< class C, class O >
+static void FormatInto( std::basic_string<C>& sOut, const C* sFormat, va_list ap )
+{
+	for( const C* p = sFormat; *p; p++ )
+	{
+		if( '%' != *p )
+		{
+			sOut += *p;
+			continue;
+		}
+
+		p++;
+
+		if( '%' == *p )
+		{
+			sOut += '%';
+			continue;
+		}
+
+		bool bLeft = false;
+		bool bZero = false;
+		bool b64 = false;
+		int nWidth = 0;
+
+		for( ; ('-' == *p) || ('0' == *p); p++ )
+		{
+			if( '-' == *p ) bLeft = true;
+			else bZero = true;
+		}
+
+		for( ; (*p >= '0') && (*p <= '9'); p++ ) nWidth = nWidth * 10 + (*p - '0');
+
+		if( ('I' == p[0]) && ('6' == p[1]) && ('4' == p[2]) )
+		{
+			b64 = true;
+			p += 3;
+		}
+		else if( 'l' == *p )
+		{
+			p++;
+		}
+
+		std::basic_string<C> sField;
+		char sNumber[32];
+
+		switch( *p )
+		{
+		case 'd':
+			if( b64 ) snprintf( sNumber, sizeof(sNumber), "%lld", (long long)va_arg( ap, int64_t ) );
+			else snprintf( sNumber, sizeof(sNumber), "%d", va_arg( ap, int32_t ) );
+			for( char* q = sNumber; *q; q++ ) sField += (C)*q;
+			break;
+
+		case 'u':
+		case 'x':
+			if( b64 ) snprintf( sNumber, sizeof(sNumber), ('u' == *p) ? "%llu" : "%llx", (unsigned long long)va_arg( ap, uint64_t ) );
+			else snprintf( sNumber, sizeof(sNumber), ('u' == *p) ? "%u" : "%x", va_arg( ap, uint32_t ) );
+			for( char* q = sNumber; *q; q++ ) sField += (C)*q;
+			break;
+
+		case 'c':
+			sField += (C)va_arg( ap, int );
+			break;
+
+		case 's':
+			{
+				const C* s = va_arg( ap, const C* );
+				for( ; *s; s++ ) sField += *s;
+			}
+			break;
+
+		case 'S':
+			{
+				const O* s = va_arg( ap, const O* );
+				for( ; *s; s++ ) sField += (C)*s;
+			}
+			break;
+		}
+
+		while( !bLeft && ((int)sField.size() < nWidth) ) sField.insert( sField.begin(), bZero ? '0' : ' ' );
+		while( bLeft && ((int)sField.size() < nWidth) ) sField += ' ';
+
+		sOut += sField;
+	}
+}
+
+// std::wstring is not used: the library's copy assumes a 32-bit wchar_t.
+static WIDE_STRING FormatWide( const wchar_t* sFormat, va_list ap )
+{
+	WIDE_STRING s;
+
+	FormatInto<char16_t, char>( s, (const char16_t*)sFormat, ap );
+
+	return s;
+}
+
+HRESULT StringCchCopy( wchar_t* pszDest, size_t cchDest, const wchar_t* pszSrc )
+{
+	return StringCchCopyN( pszDest, cchDest, pszSrc, (size_t)-1 );
+}
+
+HRESULT StringCchCopyN( wchar_t* pszDest, size_t cchDest, const wchar_t* pszSrc, size_t cchToCopy )
+{
+	size_t i;
+
+	if( 0 == cchDest ) return STRSAFE_E_INSUFFICIENT_BUFFER;
+
+	for( i = 0; (i < cchToCopy) && pszSrc[i]; i++ )
+	{
+		if( i + 1 == cchDest )
+		{
+			pszDest[i] = 0;
+			return STRSAFE_E_INSUFFICIENT_BUFFER;
+		}
+
+		pszDest[i] = pszSrc[i];
+	}
+
+	pszDest[i] = 0;
+
+	return S_OK;
+}
+
+HRESULT StringCchCat( wchar_t* pszDest, size_t cchDest, const wchar_t* pszSrc )
+{
+	size_t n = _tcslen( pszDest );
+
+	if( n >= cchDest ) return STRSAFE_E_INSUFFICIENT_BUFFER;
+
+	return StringCchCopy( pszDest + n, cchDest - n, pszSrc );
+}
+
+HRESULT StringCchPrintf( wchar_t* pszDest, size_t cchDest, const wchar_t* pszFormat, ... )
+{
+	va_list ap;
+
+	va_start( ap, pszFormat );
+	WIDE_STRING s = FormatWide( pszFormat, ap );
+	va_end( ap );
+
+	return StringCchCopy( pszDest, cchDest, (const wchar_t*)s.c_str() );
+}
+
+HRESULT StringCchCopyA( char* pszDest, size_t cchDest, const char* pszSrc )
+{
+	size_t n = strlen( pszSrc );
+
+	if( 0 == cchDest ) return STRSAFE_E_INSUFFICIENT_BUFFER;
+
+	if( n >= cchDest )
+	{
+		memcpy( pszDest, pszSrc, cchDest - 1 );
+		pszDest[cchDest - 1] = 0;
+		return STRSAFE_E_INSUFFICIENT_BUFFER;
+	}
+
+	memcpy( pszDest, pszSrc, n + 1 );
+
+	return S_OK;
+}
+
+HRESULT StringCchPrintfA( char* pszDest, size_t cchDest, const char* pszFormat, ... )
+{
+	std::string s;
+	va_list ap;
+
+	va_start( ap, pszFormat );
+	FormatInto<char, char16_t>( s, pszFormat, ap );
+	va_end( ap );
+
+	return StringCchCopyA( pszDest, cchDest, s.c_str() );
+}
+
+int _ftprintf( FILE* hFile, const wchar_t* sFormat, ... )
+{
+	va_list ap;
+
+	va_start( ap, sFormat );
+	WIDE_STRING s = FormatWide( sFormat, ap );
+	va_end( ap );
+
+	return fputs( ToUtf8( (const wchar_t*)s.c_str(), (int)s.size() ).c_str(), hFile );
+}
+
+int _tprintf( const wchar_t* sFormat, ... )
+{
+	va_list ap;
+
+	va_start( ap, sFormat );
+	WIDE_STRING s = FormatWide( sFormat, ap );
+	va_end( ap );
+
+	return fputs( ToUtf8( (const wchar_t*)s.c_str(), (int)s.size() ).c_str(), stdout );
+}
+
+wchar_t* _fgetts( wchar_t* s, int n, FILE* hFile )
+{
+	int i = 0;
+	int c;
+
+	while( (i + 1 < n) && ((c = fgetc( hFile )) != EOF) )
+	{
+		s[i++] = (wchar_t)(uint8_t)c;
+		if( '\n' == c ) break;
+	}
+
+	if( 0 == i ) return NULL;
+
+	s[i] = 0;
+
+	return s;
+}
+
+int _tfopen_s( FILE** phFile, const wchar_t* sName, const wchar_t* sMode )
+{
+	*phFile = fopen( ToUtf8( sName, -1 ).c_str(), ToUtf8( sMode, -1 ).c_str() );
+
+	return *phFile ? 0 : errno;
+}
+
+int _setmode( int nHandle, int nMode )
+{
+	return _O_TEXT;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Memory.
+// ----------------------------------------------------------------------------
+HANDLE GetProcessHeap()
+{
+	static int nHeap;
+
+	return &nHeap;
+}
+
+// Each block carries its requested size so HeapReAlloc can zero the tail.
+LPVOID HeapAlloc( HANDLE hHeap, DWORD dwFlags, SIZE_T dwBytes )
+{
+	size_t* pBlock = (size_t*)malloc( sizeof(size_t) * 2 + dwBytes );
+
+	if( NULL == pBlock ) return NULL;
+
+	pBlock[0] = dwBytes;
+	if( dwFlags & HEAP_ZERO_MEMORY ) memset( pBlock + 2, 0, dwBytes );
+
+	return pBlock + 2;
+}
+
+LPVOID HeapReAlloc( HANDLE hHeap, DWORD dwFlags, LPVOID lpMem, SIZE_T dwBytes )
+{
+	size_t* pBlock = (size_t*)lpMem - 2;
+	size_t nOld = pBlock[0];
+
+	pBlock = (size_t*)realloc( pBlock, sizeof(size_t) * 2 + dwBytes );
+	if( NULL == pBlock ) return NULL;
+
+	pBlock[0] = dwBytes;
+	if( (dwFlags & HEAP_ZERO_MEMORY) && (dwBytes > nOld) ) memset( (BYTE*)(pBlock + 2) + nOld, 0, dwBytes - nOld );
+
+	return pBlock + 2;
+}
+
+BOOL HeapFree( HANDLE hHeap, DWORD dwFlags, LPVOID lpMem )
+{
+	if( lpMem ) free( (size_t*)lpMem - 2 );
+
+	return TRUE;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Handles. Every kernel object is a SHIM_HANDLE with a kind tag.
+// ----------------------------------------------------------------------------
+enum SHIM_HANDLE_KIND
+{
+	SHIM_FILE,
+	SHIM_PIPE,
+	SHIM_MAPPING,
+	SHIM_THREAD,
+	SHIM_PROCESS,
+	SHIM_FIND
+};
+
+struct SHIM_HANDLE
+{
+	SHIM_HANDLE_KIND			Kind;
+	int							Fd;
+	size_t						Size;
+	pthread_t					Thread;
+	bool						Joined;
+	LPTHREAD_START_ROUTINE		Routine;
+	LPVOID						Parameter;
+	pid_t						Process;
+	std::vector<std::string>	Names;
+	size_t						Next;
+};
+
+static __thread DWORD g_nShimLastError = 0;
+
+static void SetLastErrorFromErrno()
+{
+	switch( errno )
+	{
+	case ENOENT:	g_nShimLastError = ERROR_FILE_NOT_FOUND; break;
+	case EACCES:	g_nShimLastError = ERROR_ACCESS_DENIED; break;
+	case ENOMEM:	g_nShimLastError = ERROR_OUTOFMEMORY; break;
+	default:		g_nShimLastError = ERROR_INVALID_FUNCTION; break;
+	}
+}
+
+DWORD GetLastError()
+{
+	return g_nShimLastError;
+}
+
+BOOL CloseHandle( HANDLE hObject )
+{
+	SHIM_HANDLE* pHandle = (SHIM_HANDLE*)hObject;
+
+	if( (NULL == pHandle) || (INVALID_HANDLE_VALUE == hObject) ) return FALSE;
+
+	switch( pHandle->Kind )
+	{
+	case SHIM_FILE:
+	case SHIM_PIPE:
+		close( pHandle->Fd );
+		break;
+
+	case SHIM_THREAD:
+		if( !pHandle->Joined ) pthread_detach( pHandle->Thread );
+		break;
+
+	default:
+		break;
+	}
+
+	delete pHandle;
+
+	return TRUE;
+}
+
+HANDLE CreateFile( LPCTSTR lpFileName, DWORD dwDesiredAccess, DWORD dwShareMode, LPSECURITY_ATTRIBUTES lpSecurityAttributes, DWORD dwCreationDisposition, DWORD dwFlagsAndAttributes, HANDLE hTemplateFile )
+{
+	std::string sPath = ToUtf8( lpFileName, -1 );
+	int nFlags = O_CLOEXEC;
+	int fd;
+
+	for( size_t i = 0; i < sPath.size(); i++ )
+	{
+		if( '\\' == sPath[i] ) sPath[i] = '/';
+	}
+
+	// Files are never inherited by worker processes.
+	if( (dwDesiredAccess & GENERIC_READ) && (dwDesiredAccess & GENERIC_WRITE) ) nFlags |= O_RDWR;
+	else if( dwDesiredAccess & GENERIC_WRITE ) nFlags |= O_WRONLY;
+	else nFlags |= O_RDONLY;
+
+	if( CREATE_ALWAYS == dwCreationDisposition ) nFlags |= O_CREAT | O_TRUNC;
+	if( OPEN_ALWAYS == dwCreationDisposition ) nFlags |= O_CREAT;
+	if( dwFlagsAndAttributes & FILE_FLAG_WRITE_THROUGH ) nFlags |= O_DSYNC;
+
+	fd = open( sPath.c_str(), nFlags, 0644 );
+	if( fd < 0 )
+	{
+		SetLastErrorFromErrno();
+		return INVALID_HANDLE_VALUE;
+	}
+
+	SHIM_HANDLE* pHandle = new SHIM_HANDLE();
+	pHandle->Kind = SHIM_FILE;
+	pHandle->Fd = fd;
+
+	return pHandle;
+}
+
+BOOL ReadFile( HANDLE hFile, LPVOID lpBuffer, DWORD nNumberOfBytesToRead, LPDWORD lpNumberOfBytesRead, LPVOID lpOverlapped )
+{
+	SHIM_HANDLE* pHandle = (SHIM_HANDLE*)hFile;
+	DWORD nTotal = 0;
+	ssize_t n;
+
+	while( nTotal < nNumberOfBytesToRead )
+	{
+		n = read( pHandle->Fd, (BYTE*)lpBuffer + nTotal, nNumberOfBytesToRead - nTotal );
+		if( n < 0 )
+		{
+			SetLastErrorFromErrno();
+			return FALSE;
+		}
+
+		if( 0 == n ) break;
+
+		nTotal += (DWORD)n;
+
+		// A pipe read returns what has arrived rather than wait for more.
+		if( SHIM_PIPE == pHandle->Kind ) break;
+	}
+
+	*lpNumberOfBytesRead = nTotal;
+
+	return TRUE;
+}
+
+BOOL WriteFile( HANDLE hFile, LPCVOID lpBuffer, DWORD nNumberOfBytesToWrite, LPDWORD lpNumberOfBytesWritten, LPVOID lpOverlapped )
+{
+	SHIM_HANDLE* pHandle = (SHIM_HANDLE*)hFile;
+	DWORD nTotal = 0;
+	ssize_t n;
+
+	while( nTotal < nNumberOfBytesToWrite )
+	{
+		n = write( pHandle->Fd, (const BYTE*)lpBuffer + nTotal, nNumberOfBytesToWrite - nTotal );
+		if( n <= 0 )
+		{
+			if( EPIPE == errno ) g_nShimLastError = ERROR_BROKEN_PIPE;
+			else SetLastErrorFromErrno();
+			return FALSE;
+		}
+
+		nTotal += (DWORD)n;
+	}
+
+	*lpNumberOfBytesWritten = nTotal;
+
+	return TRUE;
+}
+
+BOOL GetFileSizeEx( HANDLE hFile, LARGE_INTEGER* lpFileSize )
+{
+	struct stat tStat;
+
+	if( fstat( ((SHIM_HANDLE*)hFile)->Fd, &tStat ) != 0 ) return FALSE;
+
+	lpFileSize->QuadPart = tStat.st_size;
+
+	return TRUE;
+}
+
+BOOL SetFilePointerEx( HANDLE hFile, LARGE_INTEGER liDistanceToMove, LARGE_INTEGER* lpNewFilePointer, DWORD dwMoveMethod )
+{
+	static const int nWhence[] = { SEEK_SET, SEEK_CUR, SEEK_END };
+	off_t nPosition = lseek( ((SHIM_HANDLE*)hFile)->Fd, liDistanceToMove.QuadPart, nWhence[dwMoveMethod] );
+
+	if( nPosition < 0 ) return FALSE;
+	if( lpNewFilePointer ) lpNewFilePointer->QuadPart = nPosition;
+
+	return TRUE;
+}
+
+BOOL SetEndOfFile( HANDLE hFile )
+{
+	int fd = ((SHIM_HANDLE*)hFile)->Fd;
+
+	return ftruncate( fd, lseek( fd, 0, SEEK_CUR ) ) == 0;
+}
+
+BOOL FlushFileBuffers( HANDLE hFile )
+{
+	return fsync( ((SHIM_HANDLE*)hFile)->Fd ) == 0;
+}
+
+HANDLE CreateFileMapping( HANDLE hFile, LPSECURITY_ATTRIBUTES lpAttributes, DWORD flProtect, DWORD dwMaximumSizeHigh, DWORD dwMaximumSizeLow, LPCTSTR lpName )
+{
+	LARGE_INTEGER nSize;
+
+	if( !GetFileSizeEx( hFile, &nSize ) || (0 == nSize.QuadPart) ) return NULL;
+
+	SHIM_HANDLE* pHandle = new SHIM_HANDLE();
+	pHandle->Kind = SHIM_MAPPING;
+	pHandle->Fd = ((SHIM_HANDLE*)hFile)->Fd;
+	pHandle->Size = (size_t)nSize.QuadPart;
+
+	return pHandle;
+}
+
+static std::map<LPCVOID, size_t> g_tShimViews;
+static pthread_mutex_t g_mShimViews = PTHREAD_MUTEX_INITIALIZER;
+
+LPVOID MapViewOfFile( HANDLE hFileMappingObject, DWORD dwDesiredAccess, DWORD dwFileOffsetHigh, DWORD dwFileOffsetLow, SIZE_T dwNumberOfBytesToMap )
+{
+	SHIM_HANDLE* pHandle = (SHIM_HANDLE*)hFileMappingObject;
+	void* pView = mmap( NULL, pHandle->Size, PROT_READ, MAP_PRIVATE, pHandle->Fd, 0 );
+
+	if( MAP_FAILED == pView ) return NULL;
+
+	pthread_mutex_lock( &g_mShimViews );
+	g_tShimViews[pView] = pHandle->Size;
+	pthread_mutex_unlock( &g_mShimViews );
+
+	return pView;
+}
+
+BOOL UnmapViewOfFile( LPCVOID lpBaseAddress )
+{
+	size_t nSize;
+
+	pthread_mutex_lock( &g_mShimViews );
+	nSize = g_tShimViews[lpBaseAddress];
+	g_tShimViews.erase( lpBaseAddress );
+	pthread_mutex_unlock( &g_mShimViews );
+
+	return munmap( (void*)lpBaseAddress, nSize ) == 0;
+}
+
+static BOOL NextFindEntry( SHIM_HANDLE* pHandle, WIN32_FIND_DATA* lpFindFileData )
+{
+	if( pHandle->Next >= pHandle->Names.size() ) return FALSE;
+
+	const std::string& sName = pHandle->Names[pHandle->Next++];
+	size_t i;
+
+	for( i = 0; (i < sName.size()) && (i + 1 < MAX_PATH); i++ ) lpFindFileData->cFileName[i] = (wchar_t)(uint8_t)sName[i];
+
+	lpFindFileData->cFileName[i] = 0;
+	lpFindFileData->dwFileAttributes = FILE_ATTRIBUTE_NORMAL;
+
+	return TRUE;
+}
+
+HANDLE FindFirstFile( LPCTSTR lpFileName, WIN32_FIND_DATA* lpFindFileData )
+{
+	std::string sPattern = ToUtf8( lpFileName, -1 );
+	size_t nSlash;
+	DIR* pDir;
+	struct dirent* pEntry;
+
+	for( size_t i = 0; i < sPattern.size(); i++ )
+	{
+		if( '\\' == sPattern[i] ) sPattern[i] = '/';
+	}
+
+	nSlash = sPattern.rfind( '/' );
+
+	std::string sDirectory = (std::string::npos == nSlash) ? "." : sPattern.substr( 0, nSlash );
+	std::string sMatch = (std::string::npos == nSlash) ? sPattern : sPattern.substr( nSlash + 1 );
+
+	pDir = opendir( sDirectory.c_str() );
+	if( NULL == pDir ) return INVALID_HANDLE_VALUE;
+
+	SHIM_HANDLE* pHandle = new SHIM_HANDLE();
+	pHandle->Kind = SHIM_FIND;
+
+	while( (pEntry = readdir( pDir )) != NULL )
+	{
+		if( (DT_REG == pEntry->d_type) && (fnmatch( sMatch.c_str(), pEntry->d_name, 0 ) == 0) )
+		{
+			pHandle->Names.push_back( pEntry->d_name );
+		}
+	}
+
+	closedir( pDir );
+
+	if( !NextFindEntry( pHandle, lpFindFileData ) )
+	{
+		delete pHandle;
+		return INVALID_HANDLE_VALUE;
+	}
+
+	return pHandle;
+}
+
+BOOL FindNextFile( HANDLE hFindFile, WIN32_FIND_DATA* lpFindFileData )
+{
+	return NextFindEntry( (SHIM_HANDLE*)hFindFile, lpFindFileData );
+}
+
+BOOL FindClose( HANDLE hFindFile )
+{
+	return CloseHandle( hFindFile );
+}
+
+HANDLE GetStdHandle( DWORD nStdHandle )
+{
+	static SHIM_HANDLE tHandles[3];
+
+	for( int i = 0; i < 3; i++ )
+	{
+		tHandles[i].Kind = SHIM_FILE;
+		tHandles[i].Fd = i;
+	}
+
+	if( STD_INPUT_HANDLE == nStdHandle ) return &tHandles[0];
+	if( STD_OUTPUT_HANDLE == nStdHandle ) return &tHandles[1];
+
+	return &tHandles[2];
+}
+
+
+// ----------------------------------------------------------------------------
+//  Threads and synchronization.
+// ----------------------------------------------------------------------------
+static void* ShimThreadStart( void* pParameter )
+{
+	SHIM_HANDLE* pHandle = (SHIM_HANDLE*)pParameter;
+
+	pHandle->Routine( pHandle->Parameter );
+
+	return NULL;
+}
+
+HANDLE CreateThread( LPSECURITY_ATTRIBUTES lpThreadAttributes, SIZE_T dwStackSize, LPTHREAD_START_ROUTINE lpStartAddress, LPVOID lpParameter, DWORD dwCreationFlags, LPDWORD lpThreadId )
+{
+	SHIM_HANDLE* pHandle = new SHIM_HANDLE();
+
+	pHandle->Kind = SHIM_THREAD;
+	pHandle->Routine = lpStartAddress;
+	pHandle->Parameter = lpParameter;
+
+	if( pthread_create( &pHandle->Thread, NULL, ShimThreadStart, pHandle ) != 0 )
+	{
+		delete pHandle;
+		return NULL;
+	}
+
+	return pHandle;
+}
+
+DWORD WaitForSingleObject( HANDLE hHandle, DWORD dwMilliseconds )
+{
+	SHIM_HANDLE* pHandle = (SHIM_HANDLE*)hHandle;
+	int nStatus;
+
+	if( (SHIM_THREAD == pHandle->Kind) && !pHandle->Joined )
+	{
+		pthread_join( pHandle->Thread, NULL );
+		pHandle->Joined = true;
+	}
+
+	if( (SHIM_PROCESS == pHandle->Kind) && !pHandle->Joined )
+	{
+		while( (waitpid( pHandle->Process, &nStatus, 0 ) < 0) && (EINTR == errno) );
+		pHandle->Joined = true;
+	}
+
+	return WAIT_OBJECT_0;
+}
+
+DWORD WaitForMultipleObjects( DWORD nCount, const HANDLE* lpHandles, BOOL bWaitAll, DWORD dwMilliseconds )
+{
+	// Windows refuses to wait on more handles than this at once.
+	if( (0 == nCount) || (nCount > MAXIMUM_WAIT_OBJECTS) )
+	{
+		g_nShimLastError = ERROR_INVALID_PARAMETER;
+		return WAIT_FAILED;
+	}
+
+	for( DWORD i = 0; i < nCount; i++ ) WaitForSingleObject( lpHandles[i], dwMilliseconds );
+
+	return WAIT_OBJECT_0;
+}
+
+void Sleep( DWORD dwMilliseconds )
+{
+	usleep( dwMilliseconds * 1000 );
+}
+
+void InitializeCriticalSection( LPCRITICAL_SECTION lpCriticalSection )
+{
+	pthread_mutexattr_t tAttributes;
+	pthread_mutex_t* pMutex = new pthread_mutex_t;
+
+	pthread_mutexattr_init( &tAttributes );
+	pthread_mutexattr_settype( &tAttributes, PTHREAD_MUTEX_RECURSIVE );
+	pthread_mutex_init( pMutex, &tAttributes );
+	pthread_mutexattr_destroy( &tAttributes );
+
+	lpCriticalSection->Mutex = pMutex;
+}
+
+void DeleteCriticalSection( LPCRITICAL_SECTION lpCriticalSection )
+{
+	pthread_mutex_destroy( (pthread_mutex_t*)lpCriticalSection->Mutex );
+	delete (pthread_mutex_t*)lpCriticalSection->Mutex;
+}
+
+void EnterCriticalSection( LPCRITICAL_SECTION lpCriticalSection )
+{
+	pthread_mutex_lock( (pthread_mutex_t*)lpCriticalSection->Mutex );
+}
+
+void LeaveCriticalSection( LPCRITICAL_SECTION lpCriticalSection )
+{
+	pthread_mutex_unlock( (pthread_mutex_t*)lpCriticalSection->Mutex );
+}
+
+LONG InterlockedIncrement( LONG volatile* Addend )
+{
+	return __sync_add_and_fetch( Addend, 1 );
+}
+
+LONG InterlockedExchangeAdd( LONG volatile* Addend, LONG Value )
+{
+	return __sync_fetch_and_add( Addend, Value );
+}
+
+
+// ----------------------------------------------------------------------------
+//  Processes and pipes.
+// ----------------------------------------------------------------------------
+BOOL CreatePipe( HANDLE* hReadPipe, HANDLE* hWritePipe, LPSECURITY_ATTRIBUTES lpPipeAttributes, DWORD nSize )
+{
+	int hPipe[2];
+
+	// Writing to a worker that died fails with ERROR_BROKEN_PIPE, as on
+	// Windows, instead of killing the coordinator.
+	signal( SIGPIPE, SIG_IGN );
+
+	if( pipe2( hPipe, (lpPipeAttributes && lpPipeAttributes->bInheritHandle) ? 0 : O_CLOEXEC ) != 0 )
+	{
+		SetLastErrorFromErrno();
+		return FALSE;
+	}
+
+	SHIM_HANDLE* pRead = new SHIM_HANDLE();
+	pRead->Kind = SHIM_PIPE;
+	pRead->Fd = hPipe[0];
+
+	SHIM_HANDLE* pWrite = new SHIM_HANDLE();
+	pWrite->Kind = SHIM_PIPE;
+	pWrite->Fd = hPipe[1];
+
+	*hReadPipe = pRead;
+	*hWritePipe = pWrite;
+
+	return TRUE;
+}
+
+BOOL SetHandleInformation( HANDLE hObject, DWORD dwMask, DWORD dwFlags )
+{
+	SHIM_HANDLE* pHandle = (SHIM_HANDLE*)hObject;
+	int nFlags;
+
+	if( !(dwMask & HANDLE_FLAG_INHERIT) ) return TRUE;
+
+	nFlags = fcntl( pHandle->Fd, F_GETFD );
+	if( nFlags < 0 )
+	{
+		SetLastErrorFromErrno();
+		return FALSE;
+	}
+
+	if( dwFlags & HANDLE_FLAG_INHERIT ) nFlags &= ~FD_CLOEXEC;
+	else nFlags |= FD_CLOEXEC;
+
+	if( fcntl( pHandle->Fd, F_SETFD, nFlags ) != 0 )
+	{
+		SetLastErrorFromErrno();
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+// Splits a command line the way the Microsoft C runtime does: arguments
+// are separated by blanks, double quotes group, and backslashes are only
+// special in front of a double quote.
+static std::vector<std::string> SplitCommandLine( const wchar_t* sCommandLine )
+{
+	std::string sLine = ToUtf8( sCommandLine, -1 );
+	std::vector<std::string> tArguments;
+	std::string sArgument;
+	bool bQuoted = false;
+	bool bStarted = false;
+	size_t nSlashes;
+
+	for( size_t i = 0; i < sLine.size(); i++ )
+	{
+		char c = sLine[i];
+
+		if( '\\' == c )
+		{
+			for( nSlashes = 0; (i < sLine.size()) && ('\\' == sLine[i]); i++ ) nSlashes++;
+
+			if( (i < sLine.size()) && ('"' == sLine[i]) )
+			{
+				sArgument.append( nSlashes / 2, '\\' );
+
+				if( nSlashes % 2 ) sArgument += '"';
+				else bQuoted = !bQuoted;
+			}
+			else
+			{
+				sArgument.append( nSlashes, '\\' );
+				i--;
+			}
+
+			bStarted = true;
+		}
+		else if( '"' == c )
+		{
+			bQuoted = !bQuoted;
+			bStarted = true;
+		}
+		else if( ((' ' == c) || ('\t' == c)) && !bQuoted )
+		{
+			if( bStarted ) tArguments.push_back( sArgument );
+
+			sArgument.clear();
+			bStarted = false;
+		}
+		else
+		{
+			sArgument += c;
+			bStarted = true;
+		}
+	}
+
+	if( bStarted ) tArguments.push_back( sArgument );
+
+	return tArguments;
+}
+
+BOOL CreateProcess( LPCTSTR lpApplicationName, LPTSTR lpCommandLine, LPSECURITY_ATTRIBUTES lpProcessAttributes, LPSECURITY_ATTRIBUTES lpThreadAttributes, BOOL bInheritHandles, DWORD dwCreationFlags, LPVOID lpEnvironment, LPCTSTR lpCurrentDirectory, STARTUPINFO* lpStartupInfo, PROCESS_INFORMATION* lpProcessInformation )
+{
+	std::vector<std::string> tArguments = SplitCommandLine( lpCommandLine );
+	std::vector<char*> tArgv;
+	std::string sProgram;
+	int hStd[3] = { 0, 1, 2 };
+	int hStatus[2];
+	int nError = 0;
+	ssize_t n;
+	pid_t nProcess;
+
+	if( tArguments.empty() )
+	{
+		g_nShimLastError = ERROR_INVALID_PARAMETER;
+		return FALSE;
+	}
+
+	sProgram = lpApplicationName ? ToUtf8( lpApplicationName, -1 ) : tArguments[0];
+
+	for( size_t i = 0; i < tArguments.size(); i++ ) tArgv.push_back( &tArguments[i][0] );
+	tArgv.push_back( NULL );
+
+	if( lpStartupInfo && (lpStartupInfo->dwFlags & STARTF_USESTDHANDLES) )
+	{
+		hStd[0] = ((SHIM_HANDLE*)lpStartupInfo->hStdInput)->Fd;
+		hStd[1] = ((SHIM_HANDLE*)lpStartupInfo->hStdOutput)->Fd;
+		hStd[2] = ((SHIM_HANDLE*)lpStartupInfo->hStdError)->Fd;
+	}
+
+	// The child reports a failed exec on a pipe that closes once exec
+	// succeeds, so a missing program fails here as it does on Windows.
+	if( pipe2( hStatus, O_CLOEXEC ) != 0 )
+	{
+		SetLastErrorFromErrno();
+		return FALSE;
+	}
+
+	nProcess = fork();
+	if( 0 == nProcess )
+	{
+		// Only async-signal-safe calls between fork and exec.
+		for( int i = 0; i < 3; i++ )
+		{
+			if( hStd[i] != i ) dup2( hStd[i], i );
+		}
+
+		signal( SIGPIPE, SIG_DFL );
+		execv( sProgram.c_str(), tArgv.data() );
+
+		nError = errno;
+		n = write( hStatus[1], &nError, sizeof(nError) );
+		_exit( 127 );
+	}
+
+	if( nProcess < 0 ) nError = errno;
+
+	close( hStatus[1] );
+
+	while( (nProcess > 0) && ((n = read( hStatus[0], &nError, sizeof(nError) )) < 0) && (EINTR == errno) );
+
+	close( hStatus[0] );
+
+	if( nError )
+	{
+		if( nProcess > 0 ) waitpid( nProcess, NULL, 0 );
+
+		errno = nError;
+		SetLastErrorFromErrno();
+		return FALSE;
+	}
+
+	SHIM_HANDLE* pProcess = new SHIM_HANDLE();
+	pProcess->Kind = SHIM_PROCESS;
+	pProcess->Process = nProcess;
+
+	// The process has no separate thread to wait on.
+	SHIM_HANDLE* pThread = new SHIM_HANDLE();
+	pThread->Kind = SHIM_PROCESS;
+	pThread->Joined = true;
+
+	lpProcessInformation->hProcess = pProcess;
+	lpProcessInformation->hThread = pThread;
+	lpProcessInformation->dwProcessId = (DWORD)nProcess;
+	lpProcessInformation->dwThreadId = (DWORD)nProcess;
+
+	return TRUE;
+}
+
+DWORD GetModuleFileName( LPVOID hModule, LPTSTR lpFilename, DWORD nSize )
+{
+	char sPath[MAX_PATH];
+	ssize_t n = readlink( "/proc/self/exe", sPath, sizeof(sPath) );
+	ssize_t i;
+
+	if( (n <= 0) || ((size_t)n >= min( (size_t)nSize, sizeof(sPath) )) )
+	{
+		g_nShimLastError = ERROR_INSUFFICIENT_BUFFER;
+		return 0;
+	}
+
+	for( i = 0; i < n; i++ ) lpFilename[i] = (wchar_t)(uint8_t)sPath[i];
+	lpFilename[i] = 0;
+
+	return (DWORD)n;
+}
+
+
+// ----------------------------------------------------------------------------
+//  System information.
+// ----------------------------------------------------------------------------
+static BOOL g_bShimSse2 = TRUE;
+
+void ShimSetSse2( BOOL bPresent )
+{
+	g_bShimSse2 = bPresent;
+}
+
+static DWORD g_nShimProcessors = 0;
+
+// Pretends to have the given number of processors; 0 reports the real count.
+void ShimSetProcessorCount( DWORD nProcessors )
+{
+	g_nShimProcessors = nProcessors;
+}
+
+void GetSystemInfo( SYSTEM_INFO* lpSystemInfo )
+{
+	long nProcessors = g_nShimProcessors ? (long)g_nShimProcessors : sysconf( _SC_NPROCESSORS_ONLN );
+
+	lpSystemInfo->dwNumberOfProcessors = (nProcessors > 0) ? (DWORD)nProcessors : 1;
+}
+
+BOOL IsProcessorFeaturePresent( DWORD ProcessorFeature )
+{
+	return (PF_XMMI64_INSTRUCTIONS_AVAILABLE == ProcessorFeature) ? g_bShimSse2 : FALSE;
+}
+
+BOOL GetComputerName( LPTSTR lpBuffer, LPDWORD nSize )
+{
+	StringCchCopy( lpBuffer, *nSize, L"LOCALHOST" );
+	*nSize = (DWORD)_tcslen( lpBuffer );
+
+	return TRUE;
+}
+
+void GetLocalTime( SYSTEMTIME* lpSystemTime )
+{
+	time_t t = time( NULL );
+	struct tm tLocal;
+
+	localtime_r( &t, &tLocal );
+
+	memset( lpSystemTime, 0, sizeof(*lpSystemTime) );
+	lpSystemTime->wYear = (WORD)(tLocal.tm_year + 1900);
+	lpSystemTime->wMonth = (WORD)(tLocal.tm_mon + 1);
+	lpSystemTime->wDay = (WORD)tLocal.tm_mday;
+	lpSystemTime->wHour = (WORD)tLocal.tm_hour;
+	lpSystemTime->wMinute = (WORD)tLocal.tm_min;
+	lpSystemTime->wSecond = (WORD)tLocal.tm_sec;
+}
+
+int GetTimeFormat( DWORD Locale, DWORD dwFlags, const SYSTEMTIME* lpTime, LPCTSTR lpFormat, LPTSTR lpTimeStr, int cchTime )
+{
+	StringCchPrintf( lpTimeStr, cchTime, L"%02u%02u%02u", lpTime->wHour, lpTime->wMinute, lpTime->wSecond );
+
+	return (int)_tcslen( lpTimeStr ) + 1;
+}
+
+int GetDateFormat( DWORD Locale, DWORD dwFlags, const SYSTEMTIME* lpDate, LPCTSTR lpFormat, LPTSTR lpDateStr, int cchDate )
+{
+	StringCchPrintf( lpDateStr, cchDate, L"%02u%02u%04u", lpDate->wMonth, lpDate->wDay, lpDate->wYear );
+
+	return (int)_tcslen( lpDateStr ) + 1;
+}
+
+
+// ----------------------------------------------------------------------------
+//  Registry. Keys are identified by their full upper case path; a key
+//  exists if a value was set on it or on any key below it.
+// ----------------------------------------------------------------------------
+struct SHIM_VALUE
+{
+	WIDE_STRING			Name;
+	DWORD				Type;
+	std::vector<BYTE>	Data;
+};
+
+struct SHIM_KEY
+{
+	WIDE_STRING	Path;
+};
+
+static std::map<WIDE_STRING, std::vector<SHIM_VALUE> >	g_tShimValues;
+static std::map<WIDE_STRING, std::vector<WIDE_STRING> >	g_tShimSubkeys;
+
+static WIDE_STRING UpperPath( const WIDE_STRING& sPath )
+{
+	WIDE_STRING sResult = sPath;
+
+	for( size_t i = 0; i < sResult.size(); i++ ) sResult[i] = (char16_t)FoldCase( (wchar_t)sResult[i] );
+
+	return sResult;
+}
+
+static bool ShimKeyExists( const WIDE_STRING& sPath )
+{
+	return sPath.empty() || g_tShimValues.count( sPath ) || g_tShimSubkeys.count( sPath );
+}
+
+void ShimRegistryReset()
+{
+	g_tShimValues.clear();
+	g_tShimSubkeys.clear();
+}
+
+void ShimRegistrySetValue( LPCTSTR sKeyPath, LPCTSTR sValueName, DWORD nType, const void* pData, DWORD nSize )
+{
+	WIDE_STRING sPath = Widen( sKeyPath );
+	WIDE_STRING sUpper = UpperPath( sPath );
+	SHIM_VALUE tValue;
+
+	tValue.Name = Widen( sValueName );
+	tValue.Type = nType;
+	tValue.Data.assign( (const BYTE*)pData, (const BYTE*)pData + nSize );
+
+	g_tShimValues[sUpper].push_back( tValue );
+
+	// Register the key with each of its parents.
+	for( size_t nSlash = sPath.rfind( u'\\' ); ; nSlash = sPath.rfind( u'\\' ) )
+	{
+		WIDE_STRING sParent = (WIDE_STRING::npos == nSlash) ? WIDE_STRING() : sPath.substr( 0, nSlash );
+		WIDE_STRING sChild = (WIDE_STRING::npos == nSlash) ? sPath : sPath.substr( nSlash + 1 );
+		std::vector<WIDE_STRING>& tChildren = g_tShimSubkeys[UpperPath( sParent )];
+		bool bKnown = false;
+
+		for( size_t i = 0; i < tChildren.size(); i++ )
+		{
+			if( UpperPath( tChildren[i] ) == UpperPath( sChild ) ) bKnown = true;
+		}
+
+		if( !bKnown ) tChildren.push_back( sChild );
+		if( sParent.empty() ) break;
+
+		sPath = sParent;
+	}
+}
+
+void ShimRegistrySetString( LPCTSTR sKeyPath, LPCTSTR sValueName, LPCTSTR sValue )
+{
+	ShimRegistrySetValue( sKeyPath, sValueName, REG_SZ, sValue, (DWORD)((_tcslen( sValue ) + 1) * sizeof(TCHAR)) );
+}
+
+void ShimRegistrySetDword( LPCTSTR sKeyPath, LPCTSTR sValueName, DWORD nValue )
+{
+	ShimRegistrySetValue( sKeyPath, sValueName, REG_DWORD, &nValue, sizeof(nValue) );
+}
+
+LONG RegOpenKeyEx( HKEY hKey, LPCTSTR lpSubKey, DWORD ulOptions, DWORD samDesired, PHKEY phkResult )
+{
+	WIDE_STRING sPath = (HKEY_LOCAL_MACHINE == hKey) ? WIDE_STRING() : hKey->Path;
+
+	if( !sPath.empty() ) sPath += u'\\';
+	sPath += UpperPath( Widen( lpSubKey ) );
+
+	if( !ShimKeyExists( sPath ) ) return ERROR_FILE_NOT_FOUND;
+
+	*phkResult = new SHIM_KEY();
+	(*phkResult)->Path = sPath;
+
+	return ERROR_SUCCESS;
+}
+
+LONG RegCloseKey( HKEY hKey )
+{
+	if( HKEY_LOCAL_MACHINE != hKey ) delete hKey;
+
+	return ERROR_SUCCESS;
+}
+
+LONG RegConnectRegistry( LPCTSTR lpMachineName, HKEY hKey, PHKEY phkResult )
+{
+	return ERROR_ACCESS_DENIED;
+}
+
+LONG RegQueryInfoKey( HKEY hKey, LPTSTR lpClass, LPDWORD lpcClass, LPDWORD lpReserved, LPDWORD lpcSubKeys, LPDWORD lpcMaxSubKeyLen, LPDWORD lpcMaxClassLen, LPDWORD lpcValues, LPDWORD lpcMaxValueNameLen, LPDWORD lpcMaxValueLen, LPDWORD lpcbSecurityDescriptor, LPVOID lpftLastWriteTime )
+{
+	const std::vector<WIDE_STRING>& tChildren = g_tShimSubkeys[hKey->Path];
+	DWORD nLongest = 0;
+
+	for( size_t i = 0; i < tChildren.size(); i++ ) nLongest = max( nLongest, (DWORD)tChildren[i].size() );
+
+	if( lpcSubKeys ) *lpcSubKeys = (DWORD)tChildren.size();
+	if( lpcMaxSubKeyLen ) *lpcMaxSubKeyLen = nLongest;
+	if( lpcValues ) *lpcValues = (DWORD)g_tShimValues[hKey->Path].size();
+
+	return ERROR_SUCCESS;
+}
+
+LONG RegEnumKeyEx( HKEY hKey, DWORD dwIndex, LPTSTR lpName, LPDWORD lpcName, LPDWORD lpReserved, LPTSTR lpClass, LPDWORD lpcClass, LPVOID lpftLastWriteTime )
+{
+	const std::vector<WIDE_STRING>& tChildren = g_tShimSubkeys[hKey->Path];
+
+	if( dwIndex >= tChildren.size() ) return ERROR_NO_MORE_ITEMS;
+	if( tChildren[dwIndex].size() + 1 > *lpcName ) return ERROR_MORE_DATA;
+
+	memcpy( lpName, tChildren[dwIndex].c_str(), (tChildren[dwIndex].size() + 1) * sizeof(TCHAR) );
+	*lpcName = (DWORD)tChildren[dwIndex].size();
+
+	return ERROR_SUCCESS;
+}
+
+LONG RegEnumValue( HKEY hKey, DWORD dwIndex, LPTSTR lpValueName, LPDWORD lpcValueName, LPDWORD lpReserved, LPDWORD lpType, LPBYTE lpData, LPDWORD lpcbData )
+{
+	const std::vector<SHIM_VALUE>& tValues = g_tShimValues[hKey->Path];
+
+	if( dwIndex >= tValues.size() ) return ERROR_NO_MORE_ITEMS;
+
+	const SHIM_VALUE& tValue = tValues[dwIndex];
+
+	if( tValue.Name.size() + 1 > *lpcValueName ) return ERROR_MORE_DATA;
+
+	memcpy( lpValueName, tValue.Name.c_str(), (tValue.Name.size() + 1) * sizeof(TCHAR) );
+	*lpcValueName = (DWORD)tValue.Name.size();
+
+	if( lpType ) *lpType = tValue.Type;
+
+	if( lpcbData )
+	{
+		if( tValue.Data.size() > *lpcbData )
+		{
+			*lpcbData = (DWORD)tValue.Data.size();
+			return ERROR_MORE_DATA;
+		}
+
+		if( lpData && !tValue.Data.empty() ) memcpy( lpData, &tValue.Data[0], tValue.Data.size() );
+		*lpcbData = (DWORD)tValue.Data.size();
+	}
+
+	return ERROR_SUCCESS;
+}
@@ -0,0 +1,28 @@
+// ----------------------------------------------------------------------------
+//  File name: strsafe.h
+//
+//  The StringCch functions used by instsoft.cpp, for the Linux test build.
+//  The printf-style functions follow the Microsoft conventions: %s is the
+//  width of the format string, %S the other width, and "l" is 32 bits.
+// ----------------------------------------------------------------------------
+#ifndef INSTSOFT_TEST_STRSAFE_H
+#define INSTSOFT_TEST_STRSAFE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int32_t HRESULT;
+
+#define S_OK							((HRESULT)0)
+#define STRSAFE_E_INSUFFICIENT_BUFFER	((HRESULT)0x8007007AL)
+#define SUCCEEDED(hr)	(((HRESULT)(hr)) >= 0)
+#define FAILED(hr)		(((HRESULT)(hr)) < 0)
+
+HRESULT	StringCchCopy( wchar_t* pszDest, size_t cchDest, const wchar_t* pszSrc );
+HRESULT	StringCchCopyN( wchar_t* pszDest, size_t cchDest, const wchar_t* pszSrc, size_t cchToCopy );
+HRESULT	StringCchCat( wchar_t* pszDest, size_t cchDest, const wchar_t* pszSrc );
+HRESULT	StringCchPrintf( wchar_t* pszDest, size_t cchDest, const wchar_t* pszFormat, ... );
+HRESULT	StringCchCopyA( char* pszDest, size_t cchDest, const char* pszSrc );
+HRESULT	StringCchPrintfA( char* pszDest, size_t cchDest, const char* pszFormat, ... );
+
+#endif
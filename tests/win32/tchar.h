@@ -0,0 +1,26 @@
+// ----------------------------------------------------------------------------
+//  File name: tchar.h
+//
+//  UNICODE generic-text mappings for the Linux test build. Implemented in
+//  shim.cpp against 16-bit wchar_t rather than the C library's wide
+//  functions, which assume a 32-bit wchar_t.
+// ----------------------------------------------------------------------------
+#ifndef INSTSOFT_TEST_TCHAR_H
+#define INSTSOFT_TEST_TCHAR_H
+
+#include <stdio.h>
+
+// The program entry point is renamed so tests can provide main.
+#define _tmain	InstsoftMain
+
+size_t			_tcslen( const wchar_t* s );
+int				_tcscmp( const wchar_t* a, const wchar_t* b );
+const wchar_t*	_tcsrchr( const wchar_t* s, wchar_t c );
+unsigned long	_tcstoul( const wchar_t* s, wchar_t** pEnd, int nBase );
+int				_istspace( wchar_t c );
+wchar_t*		_fgetts( wchar_t* s, int n, FILE* hFile );
+int				_tfopen_s( FILE** phFile, const wchar_t* sName, const wchar_t* sMode );
+int				_ftprintf( FILE* hFile, const wchar_t* sFormat, ... );
+int				_tprintf( const wchar_t* sFormat, ... );
+
+#endif